@@ -0,0 +1,292 @@
+/*
+ * Copyright (C) 2026 The Regents of the University of California.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __AKARENA_H
+#define __AKARENA_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** @file
+ *
+ * @brief A simple size-class arena for very many small allocations that are
+ * all released together.
+ *
+ * Requests of up to AKARENA_MAX_SIZE bytes are rounded up to a power of two
+ * and carved out of large chunks, with one free list per size class. Unlike
+ * malloc, no header is stored with each allocation (the caller passes the
+ * size back to akarena_free and akarena_realloc), and akarena_destroy or
+ * akarena_reset release everything at once, without visiting each
+ * allocation. Larger requests fall back to malloc, but are still tracked by
+ * the arena.
+ *
+ * Allocations are aligned to 8 bytes. An arena is not thread-safe.
+ *
+ */
+
+/* prevent warnings for unused, macro-generated functions */
+#if __GNUC__ >= 3
+#  ifndef UNUSED
+#    define UNUSED  __attribute__((unused))
+#  endif
+#else
+#  ifndef UNUSED
+#    define UNUSED
+#  endif
+#endif
+
+/** log2 of the smallest size class */
+#define AKARENA_MIN_SHIFT 3
+
+/** Number of size classes (8 bytes to AKARENA_MAX_SIZE) */
+#define AKARENA_N_CLASSES 10
+
+/** Largest allocation served from the arena's chunks */
+#define AKARENA_MAX_SIZE ((size_t)1 << (AKARENA_MIN_SHIFT + AKARENA_N_CLASSES - 1))
+
+/** Size of the chunks that small allocations are carved from */
+#ifndef AKARENA_CHUNK_SIZE
+#define AKARENA_CHUNK_SIZE ((size_t)256 * 1024)
+#endif
+
+/* Header of a chunk, and of a large allocation */
+typedef struct akarena_block {
+  struct akarena_block *prev;
+  struct akarena_block *next;
+} akarena_block_t;
+
+/** An arena */
+typedef struct akarena {
+  /** Free lists, one per size class */
+  void *free[AKARENA_N_CLASSES];
+
+  /** Unused part of the current chunk */
+  char *cur;
+  char *end;
+
+  /** All chunks */
+  akarena_block_t *chunks;
+
+  /** All large allocations */
+  akarena_block_t *large;
+
+  /** Number of bytes obtained from malloc */
+  size_t reserved;
+} akarena_t;
+
+/* Size class for the given number of bytes (at most AKARENA_MAX_SIZE) */
+UNUSED static inline int __akarena_class(size_t size)
+{
+  if (size <= ((size_t)1 << AKARENA_MIN_SHIFT)) {
+    return 0;
+  }
+  return 64 - __builtin_clzll((unsigned long long)size - 1) - AKARENA_MIN_SHIFT;
+}
+
+/** Create a new, empty arena
+ *
+ * @return pointer to the arena if successful, NULL otherwise
+ */
+UNUSED static inline akarena_t *akarena_create(void)
+{
+  return calloc(1, sizeof(akarena_t));
+}
+
+/** Release all memory allocated from the arena, leaving it empty
+ *
+ * @param a             Pointer to the arena
+ */
+UNUSED static inline void akarena_reset(akarena_t *a)
+{
+  akarena_block_t *b;
+  while ((b = a->chunks) != NULL) {
+    a->chunks = b->next;
+    free(b);
+  }
+  while ((b = a->large) != NULL) {
+    a->large = b->next;
+    free(b);
+  }
+  memset(a, 0, sizeof(akarena_t));
+}
+
+/** Release all memory allocated from the arena, and the arena itself
+ *
+ * @param a             Pointer to the arena (may be NULL)
+ */
+UNUSED static inline void akarena_destroy(akarena_t *a)
+{
+  if (a == NULL) {
+    return;
+  }
+  akarena_reset(a);
+  free(a);
+}
+
+/** Allocate memory from the arena
+ *
+ * @param a             Pointer to the arena
+ * @param size          Number of bytes to allocate
+ * @return pointer to the memory if successful, NULL otherwise
+ */
+UNUSED static inline void *akarena_alloc(akarena_t *a, size_t size)
+{
+  akarena_block_t *b;
+  size_t csize;
+  void *p;
+  int c;
+
+  if (size > AKARENA_MAX_SIZE) {
+    if ((b = malloc(sizeof(akarena_block_t) + size)) == NULL) {
+      return NULL;
+    }
+    b->prev = NULL;
+    if ((b->next = a->large) != NULL) {
+      b->next->prev = b;
+    }
+    a->large = b;
+    a->reserved += sizeof(akarena_block_t) + size;
+    return b + 1;
+  }
+
+  c = __akarena_class(size);
+  if ((p = a->free[c]) != NULL) {
+    a->free[c] = *(void **)p;
+    return p;
+  }
+
+  csize = (size_t)1 << (c + AKARENA_MIN_SHIFT);
+  if (a->cur == NULL || (size_t)(a->end - a->cur) < csize) {
+    /* start a new chunk (the rest of the current one is lost) */
+    if ((b = malloc(AKARENA_CHUNK_SIZE)) == NULL) {
+      return NULL;
+    }
+    b->prev = NULL;
+    b->next = a->chunks;
+    a->chunks = b;
+    a->reserved += AKARENA_CHUNK_SIZE;
+    a->cur = (char *)(b + 1);
+    a->end = (char *)b + AKARENA_CHUNK_SIZE;
+  }
+  p = a->cur;
+  a->cur += csize;
+  return p;
+}
+
+/** Return memory to the arena
+ *
+ * @param a             Pointer to the arena
+ * @param p             Pointer to the memory (may be NULL)
+ * @param size          Size that the memory was allocated with
+ */
+UNUSED static inline void akarena_free(akarena_t *a, void *p, size_t size)
+{
+  akarena_block_t *b;
+  int c;
+
+  if (p == NULL) {
+    return;
+  }
+  if (size > AKARENA_MAX_SIZE) {
+    b = (akarena_block_t *)p - 1;
+    if (b->prev != NULL) {
+      b->prev->next = b->next;
+    } else {
+      a->large = b->next;
+    }
+    if (b->next != NULL) {
+      b->next->prev = b->prev;
+    }
+    a->reserved -= sizeof(akarena_block_t) + size;
+    free(b);
+    return;
+  }
+  c = __akarena_class(size);
+  *(void **)p = a->free[c];
+  a->free[c] = p;
+}
+
+/** Resize memory allocated from the arena
+ *
+ * @param a             Pointer to the arena
+ * @param p             Pointer to the memory (may be NULL)
+ * @param old_size      Size that the memory was allocated with
+ * @param size          New size
+ * @return pointer to the resized memory if successful, NULL otherwise (in
+ *         which case p is left untouched)
+ *
+ * Growing within a size class does not move the memory.
+ */
+UNUSED static inline void *akarena_realloc(akarena_t *a, void *p,
+                                           size_t old_size, size_t size)
+{
+  akarena_block_t *b, *nb;
+  void *np;
+
+  if (p == NULL) {
+    return akarena_alloc(a, size);
+  }
+  if (old_size <= AKARENA_MAX_SIZE && size <= AKARENA_MAX_SIZE &&
+      __akarena_class(old_size) == __akarena_class(size)) {
+    return p;
+  }
+  if (old_size > AKARENA_MAX_SIZE && size > AKARENA_MAX_SIZE) {
+    b = (akarena_block_t *)p - 1;
+    if ((nb = realloc(b, sizeof(akarena_block_t) + size)) == NULL) {
+      return NULL;
+    }
+    /* relink the (possibly moved) block */
+    if (nb->prev != NULL) {
+      nb->prev->next = nb;
+    } else {
+      a->large = nb;
+    }
+    if (nb->next != NULL) {
+      nb->next->prev = nb;
+    }
+    a->reserved += size - old_size;
+    return nb + 1;
+  }
+  if ((np = akarena_alloc(a, size)) == NULL) {
+    return NULL;
+  }
+  memcpy(np, p, old_size < size ? old_size : size);
+  akarena_free(a, p, old_size);
+  return np;
+}
+
+/** Get the number of bytes the arena has obtained from malloc
+ *
+ * @param a             Pointer to the arena
+ * @return number of bytes reserved by the arena
+ */
+UNUSED static inline size_t akarena_size(akarena_t *a)
+{
+  return a->reserved;
+}
+
+#endif /* __AKARENA_H */
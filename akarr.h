@@ -34,12 +34,30 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "akarena.h"
+
 /** @file
  *
  * @brief A macro-based array management implementation. Especially helpful for
  * uses where the common case is a small (< 8) number of small (1-2 byte)
  * elements as it does some trickery with pointers to optimize memory use in
- * this case.
+ * this case: while they fit, the values are stored in the bytes of the pointer
+ * itself (through a union, so this works for any pointer size and byte order).
+ *
+ * AKARR_INIT_GROW gives the same interface (plus akarr_reserve) for arrays
+ * that may get large: once values spill out of the pointer, their storage
+ * grows geometrically instead of being reallocated on every append.
+ *
+ * Both variants also provide bulk operations (akarr_copy_out, akarr_copy_in,
+ * akarr_find, akarr_contains and akarr_sorted_insert) that look up where the
+ * values are stored once rather than for every element.
+ *
+ * AKARR_INIT_SET keeps the values of a grow array sorted and unique, giving
+ * binary search lookups, insert-if-absent and fast unions and intersections.
+ *
+ * Each operation that allocates memory also has an akarr_*_ctx form that
+ * takes spilled storage from an akarena_t (see akarena.h), which avoids a
+ * malloc header per array and releases the storage of many arrays at once.
  *
  * @author Alistair King
  *
@@ -130,76 +148,126 @@ typedef enum {
 /* some helper macros */
 
 /** How many values can be jammed directly into the pointer address ;) */
-#define AKARR_IMM_STORAGE_CNT(akarr_val_t)      \
-  (sizeof(akarr_val_t*)/sizeof(akarr_val_t))
-
-#define AKARR_IMM_SHIFT(akarr_val_t, idx)               \
-  (((sizeof(akarr_val_t*) - sizeof(akarr_val_t)) -      \
-    ((idx) * sizeof(akarr_val_t))) * 8)
-
-#define AKARR_IMM_MASK(akarr_val_t)             \
-  (((uint64_t)1 << (sizeof(akarr_val_t)*8)) - 1)
-
-#define AKARR_IMM_SET(akarr_val_t, dst, idx, val)                       \
-  do {                                                                  \
-    /* what is the left-shift for this index? */                        \
-    int lshift = AKARR_IMM_SHIFT(akarr_val_t, (idx));                   \
-    /* zero out the value currently at that location */                 \
-    (dst) = (akarr_val_t*)                                              \
-      ((uint64_t)(dst) & ~(AKARR_IMM_MASK(akarr_val_t)<<lshift));       \
-    /* and now stick our value in */                                    \
-    (dst) = (akarr_val_t*) ((uint64_t)(dst) | ((uint64_t)val << lshift)); \
-  } while (0)
-
-#define AKARR_IMM_GET(akarr_val_t, dst, idx)                            \
-  ((akarr_val_t)(((uint64_t)(dst) >>                                    \
-                  (AKARR_IMM_SHIFT(akarr_val_t, idx))) &                \
-                 AKARR_IMM_MASK(akarr_val_t)))
-
-#define AKARR_CAP(akarr_len_t) ((1<<(sizeof(akarr_len_t)*8))-1)
+#define AKARR_IMM_STORAGE_CNT(akarr_val_t)                              \
+  (sizeof(void *) / sizeof(akarr_val_t))
+
+/** Largest length that an akarr_len_t can hold (signed or unsigned) */
+#define AKARR_CAP(akarr_len_t)                                          \
+  ((akarr_len_t)-1 < 0 ?                                                \
+   ((uint64_t)1 << (sizeof(akarr_len_t) * 8 - 1)) - 1 :                 \
+   (uint64_t)(akarr_len_t)-1)
 
 /** Is the array 'full'? */
 #define AKARR_FULL(akarr_len_t, cnt) ((cnt) == AKARR_CAP(akarr_len_t))
 
+/* Allocate storage for spilled values from the given arena, or with malloc
+ * if it is NULL */
+#define __akarr_alloc(arena, size)                                      \
+  ((arena) != NULL ? akarena_alloc(arena, size) : malloc(size))
+#define __akarr_realloc(arena, ptr, old_size, size)                     \
+  ((arena) != NULL ? akarena_realloc(arena, ptr, old_size, size) :      \
+   realloc(ptr, size))
+#define __akarr_free(arena, ptr, size)                                  \
+  ((arena) != NULL ? akarena_free(arena, ptr, size) : free(ptr))
+
+/* The allocating operations of each variant are implemented with an arena
+ * argument (akarr_*_ctx); these use malloc instead */
+#define __AKARR_CTX_PROTOTYPES(name, SCOPE, akarr_val_t)                \
+  SCOPE void akarr_##name##_clean(akarr_##name##_t *arrp);              \
+  SCOPE int akarr_##name##_append(akarr_##name##_t *arrp, akarr_val_t val); \
+  SCOPE int akarr_##name##_append_n(akarr_##name##_t *arrp,             \
+                                    const akarr_val_t *vals, int n);    \
+  SCOPE int akarr_##name##_truncate(akarr_##name##_t *arrp, int n);
+
+#define __AKARR_CTX_IMPL(name, SCOPE, akarr_val_t)                      \
+  SCOPE void akarr_##name##_clean(akarr_##name##_t *arrp)               \
+  {                                                                     \
+    akarr_##name##_clean_ctx(arrp, NULL);                               \
+  }                                                                     \
+  SCOPE int akarr_##name##_append(akarr_##name##_t *arrp, akarr_val_t val) \
+  {                                                                     \
+    return akarr_##name##_append_ctx(arrp, NULL, val);                  \
+  }                                                                     \
+  SCOPE int akarr_##name##_append_n(akarr_##name##_t *arrp,             \
+                                    const akarr_val_t *vals, int n)     \
+  {                                                                     \
+    return akarr_##name##_append_n_ctx(arrp, NULL, vals, n);            \
+  }                                                                     \
+  SCOPE int akarr_##name##_truncate(akarr_##name##_t *arrp, int n)      \
+  {                                                                     \
+    return akarr_##name##_truncate_ctx(arrp, NULL, n);                  \
+  }
+
+/** The values of an array: either a pointer to them, or, while they fit,
+ * the values themselves (in their native representation) */
+#define __AKARR_STORAGE(akarr_val_t)                                    \
+  union {                                                               \
+    akarr_val_t *vals;                                                  \
+    unsigned char imm[sizeof(akarr_val_t *)];                           \
+  };
+
+/* Access to values stored in the pointer. memcpy keeps these correct for
+ * any value type, pointer size and byte order (and compiles to a plain load
+ * or store) */
+#define __AKARR_IMM_IMPL(name, SCOPE, akarr_val_t)                      \
+  SCOPE akarr_val_t __akarr_##name##_imm_get(akarr_##name##_t *arrp, int idx) \
+  {                                                                     \
+    akarr_val_t val;                                                    \
+    memcpy(&val, arrp->imm + idx * sizeof(akarr_val_t), sizeof(akarr_val_t)); \
+    return val;                                                         \
+  }                                                                     \
+  SCOPE void __akarr_##name##_imm_set(akarr_##name##_t *arrp, int idx,  \
+                                      akarr_val_t val)                  \
+  {                                                                     \
+    memcpy(arrp->imm + idx * sizeof(akarr_val_t), &val, sizeof(akarr_val_t)); \
+  }
+
 /** Define a new structure type that contains a pointer to our type, and a
  * counter of the number of elements in the array.
  *
  * @todo add another type for arrays that can shrink
  */
-#define __AKARR_TYPES(name, akarr_val_t, akarr_len_t)   \
-  typedef akarr_val_t akarr_##name##_val_t;             \
-  typedef akarr_len_t akarr_##name##_len_t;             \
-  typedef struct akarr_##name##_t {                     \
-    akarr_val_t *vals;                                  \
-    akarr_len_t cnt;                                    \
+#define __AKARR_TYPES(name, akarr_val_t, akarr_len_t)                   \
+  typedef akarr_val_t akarr_##name##_val_t;                             \
+  typedef akarr_len_t akarr_##name##_len_t;                             \
+  typedef struct akarr_##name##_t {                                     \
+    __AKARR_STORAGE(akarr_val_t)                                        \
+    akarr_len_t cnt;                                                    \
   } __attribute__((packed)) akarr_##name##_t;
 
 #define __AKARR_PROTOTYPES(name, SCOPE, akarr_val_t, akarr_len_t)       \
   SCOPE void akarr_##name##_init(akarr_##name##_t *arrp);               \
-  SCOPE void akarr_##name##_clean(akarr_##name##_t *arrp);              \
-  SCOPE int akarr_##name##_append(akarr_##name##_t *arrp, akarr_val_t val); \
+  SCOPE void akarr_##name##_clean_ctx(akarr_##name##_t *arrp, akarena_t *arena); \
+  SCOPE int akarr_##name##_append_ctx(akarr_##name##_t *arrp, akarena_t *arena, \
+                                      akarr_val_t val);                 \
+  SCOPE int akarr_##name##_append_n_ctx(akarr_##name##_t *arrp, akarena_t *arena, \
+                                        const akarr_val_t *vals, int n); \
+  SCOPE int akarr_##name##_truncate_ctx(akarr_##name##_t *arrp, akarena_t *arena, \
+                                        int n);                         \
+  __AKARR_CTX_PROTOTYPES(name, SCOPE, akarr_val_t)                      \
   SCOPE void akarr_##name##_set(akarr_##name##_t *arrp, int idx, akarr_val_t val); \
   SCOPE int akarr_##name##_capacity();                                  \
   SCOPE int akarr_##name##_size(akarr_##name##_t *arrp);                \
   SCOPE akarr_val_t akarr_##name##_get(akarr_##name##_t *arrp, akarr_len_t idx);
 
 #define __AKARR_IMPL(name, SCOPE, akarr_val_t, akarr_len_t)             \
+  __AKARR_IMM_IMPL(name, SCOPE, akarr_val_t)                            \
   SCOPE void akarr_##name##_init(akarr_##name##_t *arrp)                \
   {                                                                     \
-    /* check some assumptions */                                        \
-    assert(sizeof(akarr_val_t*) <= sizeof(uint64_t));                   \
-    assert(INT_MAX >= AKARR_CAP(akarr_val_t));                          \
+    /* indexes are returned as int */                                   \
+    assert(INT_MAX >= AKARR_CAP(akarr_len_t));                          \
     arrp->vals = NULL;                                                  \
     arrp->cnt = 0;                                                      \
   }                                                                     \
-  SCOPE void akarr_##name##_clean(akarr_##name##_t *arrp)               \
+  SCOPE void akarr_##name##_clean_ctx(akarr_##name##_t *arrp, akarena_t *arena) \
   {                                                                     \
     if (arrp->cnt > AKARR_IMM_STORAGE_CNT(akarr_val_t)) {               \
-      free(arrp->vals);                                                 \
+      __akarr_free(arena, arrp->vals, sizeof(akarr_val_t) * arrp->cnt); \
     }                                                                   \
     arrp->cnt = 0;                                                      \
   }                                                                     \
-  SCOPE int akarr_##name##_append(akarr_##name##_t *arrp, akarr_val_t val) \
+  SCOPE int akarr_##name##_append_ctx(akarr_##name##_t *arrp, akarena_t *arena, \
+                                      akarr_val_t val)                  \
   {                                                                     \
     /* first, do we have capacity for another value? */                 \
     if (AKARR_FULL(akarr_len_t, arrp->cnt)) {                           \
@@ -207,41 +275,102 @@ typedef enum {
     }                                                                   \
     /* next, can we store it immediately? */                            \
     if (arrp->cnt < AKARR_IMM_STORAGE_CNT(akarr_val_t)) {               \
-      AKARR_IMM_SET(akarr_val_t, arrp->vals, arrp->cnt, val);           \
+      __akarr_##name##_imm_set(arrp, arrp->cnt, val);                   \
       return arrp->cnt++;                                               \
     }                                                                   \
     /* is this the first time that we are storing a non-immediate value? */ \
     if (AKARR_IMM_STORAGE_CNT(akarr_val_t) == arrp->cnt) {              \
       /* first, allocate enough memory for arrp->cnt+1 */               \
       akarr_val_t *tmp;                                                 \
-      if ((tmp = malloc(sizeof(akarr_val_t) * (arrp->cnt+1))) == NULL) { \
+      if ((tmp = __akarr_alloc(arena, sizeof(akarr_val_t) * (arrp->cnt+1))) == NULL) { \
         return AKARR_ERR_MALLOC;                                        \
       }                                                                 \
       /* now copy the values into this array */                         \
-      /* do it manually to avoid endianness issues */                   \
-      /* todo: improve this */                                          \
-      int i;                                                            \
-      for (i=0; i < AKARR_IMM_STORAGE_CNT(akarr_val_t); i++) {          \
-        tmp[i] = AKARR_IMM_GET(akarr_val_t, arrp->vals, i);             \
-      }                                                                 \
+      memcpy(tmp, arrp->imm, sizeof(akarr_val_t) * arrp->cnt);          \
       /* and then update the pointer */                                 \
       arrp->vals = tmp;                                                 \
     } else {                                                            \
       /* too bad, we're going need to realloc the array first :/ */     \
-      if ((arrp->vals =                                                 \
-           realloc(arrp->vals, sizeof(akarr_val_t) * (arrp->cnt+1))) == NULL) { \
+      akarr_val_t *tmp;                                                 \
+      if ((tmp = __akarr_realloc(arena, arrp->vals,                     \
+                                 sizeof(akarr_val_t) * arrp->cnt,       \
+                                 sizeof(akarr_val_t) * (arrp->cnt+1))) == NULL) { \
         return AKARR_ERR_MALLOC;                                        \
       }                                                                 \
+      arrp->vals = tmp;                                                 \
     }                                                                   \
     arrp->vals[arrp->cnt] = val;                                        \
     /* and return the index */                                          \
     return arrp->cnt++;                                                 \
   }                                                                     \
-  SCOPE void akarr_##name##_set(akarr_##name##_t *arrp, int idx, akarr_val_t val)\
+  SCOPE int akarr_##name##_append_n_ctx(akarr_##name##_t *arrp, akarena_t *arena, \
+                                        const akarr_val_t *vals, int n) \
   {                                                                     \
-    assert(idx < arrp->cnt);                                            \
-    if (arrp->cnt < AKARR_IMM_STORAGE_CNT(akarr_val_t)) {               \
-      AKARR_IMM_SET(akarr_val_t, arrp->vals, idx, val);                 \
+    akarr_val_t *tmp;                                                   \
+    int idx = arrp->cnt;                                                \
+    if (n <= 0) {                                                       \
+      return idx;                                                       \
+    }                                                                   \
+    if ((uint64_t)arrp->cnt + n > AKARR_CAP(akarr_len_t)) {             \
+      return AKARR_ERR_FULL;                                            \
+    }                                                                   \
+    if ((size_t)arrp->cnt + n <= AKARR_IMM_STORAGE_CNT(akarr_val_t)) {  \
+      memcpy(arrp->imm + sizeof(akarr_val_t) * arrp->cnt, vals,         \
+             sizeof(akarr_val_t) * n);                                  \
+      arrp->cnt += n;                                                   \
+      return idx;                                                       \
+    }                                                                   \
+    /* grow (or spill) the array just once for all n values */          \
+    if (arrp->cnt <= AKARR_IMM_STORAGE_CNT(akarr_val_t)) {              \
+      if ((tmp = __akarr_alloc(arena, sizeof(akarr_val_t) * (arrp->cnt + n))) == NULL) { \
+        return AKARR_ERR_MALLOC;                                        \
+      }                                                                 \
+      memcpy(tmp, arrp->imm, sizeof(akarr_val_t) * arrp->cnt);          \
+    } else if ((tmp = __akarr_realloc(arena, arrp->vals,                \
+                                      sizeof(akarr_val_t) * arrp->cnt,  \
+                                      sizeof(akarr_val_t) * (arrp->cnt + n))) == NULL) { \
+      return AKARR_ERR_MALLOC;                                          \
+    }                                                                   \
+    arrp->vals = tmp;                                                   \
+    memcpy(arrp->vals + arrp->cnt, vals, sizeof(akarr_val_t) * n);      \
+    arrp->cnt += n;                                                     \
+    return idx;                                                         \
+  }                                                                     \
+  SCOPE int akarr_##name##_truncate_ctx(akarr_##name##_t *arrp, akarena_t *arena, \
+                                        int n)                          \
+  {                                                                     \
+    akarr_val_t *tmp;                                                   \
+    if (n < 0) {                                                        \
+      n = 0;                                                            \
+    }                                                                   \
+    if (n >= arrp->cnt) {                                               \
+      return 0;                                                         \
+    }                                                                   \
+    if (arrp->cnt > AKARR_IMM_STORAGE_CNT(akarr_val_t)) {               \
+      if ((size_t)n <= AKARR_IMM_STORAGE_CNT(akarr_val_t)) {            \
+        /* move the remaining values back into the pointer */           \
+        tmp = arrp->vals;                                               \
+        memcpy(arrp->imm, tmp, sizeof(akarr_val_t) * n);                \
+        __akarr_free(arena, tmp, sizeof(akarr_val_t) * arrp->cnt);      \
+      } else {                                                          \
+        /* the array must stay sized for cnt, so fail rather than keep  \
+           a larger block */                                            \
+        if ((tmp = __akarr_realloc(arena, arrp->vals,                   \
+                                   sizeof(akarr_val_t) * arrp->cnt,     \
+                                   sizeof(akarr_val_t) * n)) == NULL) { \
+          return AKARR_ERR_MALLOC;                                      \
+        }                                                               \
+        arrp->vals = tmp;                                               \
+      }                                                                 \
+    }                                                                   \
+    arrp->cnt = n;                                                      \
+    return 0;                                                           \
+  }                                                                     \
+  SCOPE void akarr_##name##_set(akarr_##name##_t *arrp, int idx, akarr_val_t val) \
+  {                                                                     \
+    assert(idx >= 0 && idx < arrp->cnt);                                \
+    if (arrp->cnt <= AKARR_IMM_STORAGE_CNT(akarr_val_t)) {              \
+      __akarr_##name##_imm_set(arrp, idx, val);                         \
     } else {                                                            \
       /* now add it to the array */                                     \
       arrp->vals[idx] = val;                                            \
@@ -260,20 +389,638 @@ typedef enum {
       return sizeof(akarr_##name##_t) + (sizeof(akarr_val_t) * arrp->cnt); \
     }                                                                   \
   }                                                                     \
-  SCOPE akarr_val_t akarr_##name##_get(akarr_##name##_t *arrp, akarr_len_t idx)\
+  SCOPE akarr_val_t akarr_##name##_get(akarr_##name##_t *arrp, akarr_len_t idx) \
   {                                                                     \
     assert(idx < arrp->cnt);                                            \
     if (arrp->cnt <= AKARR_IMM_STORAGE_CNT(akarr_val_t)) {              \
-      return AKARR_IMM_GET(akarr_val_t, arrp->vals, idx);               \
+      return __akarr_##name##_imm_get(arrp, idx);                       \
     } else {                                                            \
       return arrp->vals[idx];                                           \
     }                                                                   \
+  }                                                                     \
+  __AKARR_CTX_IMPL(name, SCOPE, akarr_val_t)
+
+/** Number of values compared at once (without branching) when scanning an
+ * array, so that the compiler can vectorize the comparisons */
+#ifndef AKARR_SCAN_BLOCK
+#define AKARR_SCAN_BLOCK 16
+#endif
+
+/* Linear search used by akarr_find on unsorted arrays */
+#define __AKARR_SCAN_IMPL(name, SCOPE, akarr_val_t)                     \
+  SCOPE int __akarr_##name##_search(const akarr_val_t *vals, int n,     \
+                                    akarr_val_t val)                    \
+  {                                                                     \
+    int i, j, hit;                                                      \
+    /* find the first block with a match... */                          \
+    for (i = 0; i + AKARR_SCAN_BLOCK <= n; i += AKARR_SCAN_BLOCK) {     \
+      hit = 0;                                                          \
+      for (j = 0; j < AKARR_SCAN_BLOCK; j++) {                          \
+        hit |= vals[i + j] == val;                                      \
+      }                                                                 \
+      if (hit) {                                                        \
+        break;                                                          \
+      }                                                                 \
+    }                                                                   \
+    /* ...and the match within it (or in the tail) */                   \
+    for (; i < n; i++) {                                                \
+      if (vals[i] == val) {                                             \
+        return i;                                                       \
+      }                                                                 \
+    }                                                                   \
+    return -1;                                                          \
   }
 
-#define AKARR_INIT(name, akarr_val_t, akarr_len_t)      \
-  __AKARR_TYPES(name, akarr_val_t, akarr_len_t)         \
+/* Are the values of the array stored in the pointer itself? */
+#define __akarr_base_is_imm(arrp, akarr_val_t)                          \
+  ((arrp)->cnt <= AKARR_IMM_STORAGE_CNT(akarr_val_t))
+#define __akarr_grow_is_imm(arrp, akarr_val_t) ((arrp)->cap_log2 == 0)
+
+/* Bulk operations, shared by all array variants. Each one decides once where
+ * the values are stored, and then runs a simple loop over them. __is_imm is
+ * one of the __akarr_*_is_imm macros, and the variant must also define
+ * __akarr_##name##_search (e.g. with __AKARR_SCAN_IMPL). */
+#define __AKARR_BULK_PROTOTYPES(name, SCOPE, akarr_val_t, akarr_len_t)  \
+  SCOPE int akarr_##name##_copy_out(akarr_##name##_t *arrp, akarr_val_t *dst); \
+  SCOPE int akarr_##name##_copy_in_ctx(akarr_##name##_t *arrp, akarena_t *arena, \
+                                       const akarr_val_t *src, int n);  \
+  SCOPE int akarr_##name##_copy_in(akarr_##name##_t *arrp,              \
+                                   const akarr_val_t *src, int n);      \
+  SCOPE int akarr_##name##_find(akarr_##name##_t *arrp, akarr_val_t val); \
+  SCOPE int akarr_##name##_contains(akarr_##name##_t *arrp, akarr_val_t val); \
+  SCOPE int akarr_##name##_sorted_insert_ctx(akarr_##name##_t *arrp,    \
+                                             akarena_t *arena,          \
+                                             akarr_val_t val);          \
+  SCOPE int akarr_##name##_sorted_insert(akarr_##name##_t *arrp,        \
+                                         akarr_val_t val);
+
+#define __AKARR_BULK_IMPL(name, SCOPE, akarr_val_t, akarr_len_t, __is_imm) \
+  SCOPE void __akarr_##name##_imm_out(akarr_##name##_t *arrp,           \
+                                      akarr_val_t *dst, int n)          \
+  {                                                                     \
+    memcpy(dst, arrp->imm, sizeof(akarr_val_t) * n);                    \
+  }                                                                     \
+  SCOPE void __akarr_##name##_imm_in(akarr_##name##_t *arrp,            \
+                                     const akarr_val_t *src, int n)     \
+  {                                                                     \
+    memcpy(arrp->imm, src, sizeof(akarr_val_t) * n);                    \
+  }                                                                     \
+  SCOPE int akarr_##name##_copy_out(akarr_##name##_t *arrp, akarr_val_t *dst) \
+  {                                                                     \
+    if (__is_imm(arrp, akarr_val_t)) {                                  \
+      __akarr_##name##_imm_out(arrp, dst, arrp->cnt);                   \
+    } else {                                                            \
+      memcpy(dst, arrp->vals, sizeof(akarr_val_t) * arrp->cnt);         \
+    }                                                                   \
+    return arrp->cnt;                                                   \
+  }                                                                     \
+  SCOPE int akarr_##name##_copy_in_ctx(akarr_##name##_t *arrp, akarena_t *arena, \
+                                       const akarr_val_t *src, int n)   \
+  {                                                                     \
+    int ret;                                                            \
+    if (n < 0 || (uint64_t)n > AKARR_CAP(akarr_len_t)) {                \
+      return AKARR_ERR_FULL;                                            \
+    }                                                                   \
+    /* truncate, then append all values at once */                      \
+    if (__is_imm(arrp, akarr_val_t) || n > arrp->cnt) {                 \
+      if ((ret = akarr_##name##_truncate_ctx(arrp, arena, 0)) != 0 ||   \
+          (ret = akarr_##name##_append_n_ctx(arrp, arena, src, n)) < 0) { \
+        return ret;                                                     \
+      }                                                                 \
+    } else if ((size_t)n <= AKARR_IMM_STORAGE_CNT(akarr_val_t)) {       \
+      /* the new values fit in the existing heap array, and truncating  \
+         (which cannot fail here) moves them back into the pointer */   \
+      memcpy(arrp->vals, src, sizeof(akarr_val_t) * n);                 \
+      akarr_##name##_truncate_ctx(arrp, arena, n);                      \
+    } else {                                                            \
+      /* shrink first, so that a failure leaves the array unchanged */  \
+      if ((ret = akarr_##name##_truncate_ctx(arrp, arena, n)) != 0) {   \
+        return ret;                                                     \
+      }                                                                 \
+      memcpy(arrp->vals, src, sizeof(akarr_val_t) * n);                 \
+    }                                                                   \
+    return 0;                                                           \
+  }                                                                     \
+  SCOPE int akarr_##name##_find(akarr_##name##_t *arrp, akarr_val_t val) \
+  {                                                                     \
+    akarr_val_t buf[AKARR_IMM_STORAGE_CNT(akarr_val_t) + 1];            \
+    if (__is_imm(arrp, akarr_val_t)) {                                  \
+      __akarr_##name##_imm_out(arrp, buf, arrp->cnt);                   \
+      return __akarr_##name##_search(buf, arrp->cnt, val);              \
+    }                                                                   \
+    return __akarr_##name##_search(arrp->vals, arrp->cnt, val);         \
+  }                                                                     \
+  SCOPE int akarr_##name##_contains(akarr_##name##_t *arrp, akarr_val_t val) \
+  {                                                                     \
+    return akarr_##name##_find(arrp, val) >= 0;                         \
+  }                                                                     \
+  SCOPE int akarr_##name##_sorted_insert_ctx(akarr_##name##_t *arrp,    \
+                                             akarena_t *arena,          \
+                                             akarr_val_t val)           \
+  {                                                                     \
+    akarr_val_t buf[AKARR_IMM_STORAGE_CNT(akarr_val_t) + 1];            \
+    akarr_val_t *vals;                                                  \
+    int lo = 0, hi, mid, ret;                                           \
+    /* make room for the value (and maybe move to the heap) first */    \
+    if ((ret = akarr_##name##_append_ctx(arrp, arena, val)) < 0) {      \
+      return ret;                                                       \
+    }                                                                   \
+    if (__is_imm(arrp, akarr_val_t)) {                                  \
+      __akarr_##name##_imm_out(arrp, buf, arrp->cnt);                   \
+      vals = buf;                                                       \
+    } else {                                                            \
+      vals = arrp->vals;                                                \
+    }                                                                   \
+    /* insert after any values equal to val */                          \
+    hi = arrp->cnt - 1;                                                 \
+    while (lo < hi) {                                                   \
+      mid = lo + (hi - lo) / 2;                                         \
+      if (val < vals[mid]) {                                            \
+        hi = mid;                                                       \
+      } else {                                                          \
+        lo = mid + 1;                                                   \
+      }                                                                 \
+    }                                                                   \
+    memmove(vals + lo + 1, vals + lo,                                   \
+            sizeof(akarr_val_t) * (arrp->cnt - 1 - lo));                \
+    vals[lo] = val;                                                     \
+    if (vals == buf) {                                                  \
+      __akarr_##name##_imm_in(arrp, buf, arrp->cnt);                    \
+    }                                                                   \
+    return lo;                                                          \
+  }                                                                     \
+  SCOPE int akarr_##name##_copy_in(akarr_##name##_t *arrp,              \
+                                   const akarr_val_t *src, int n)       \
+  {                                                                     \
+    return akarr_##name##_copy_in_ctx(arrp, NULL, src, n);              \
+  }                                                                     \
+  SCOPE int akarr_##name##_sorted_insert(akarr_##name##_t *arrp,        \
+                                         akarr_val_t val)               \
+  {                                                                     \
+    return akarr_##name##_sorted_insert_ctx(arrp, NULL, val);           \
+  }
+
+#define AKARR_INIT(name, akarr_val_t, akarr_len_t)                      \
+  __AKARR_TYPES(name, akarr_val_t, akarr_len_t)                         \
   __AKARR_PROTOTYPES(name, UNUSED static inline, akarr_val_t, akarr_len_t) \
-  __AKARR_IMPL(name, UNUSED static inline, akarr_val_t, akarr_len_t)
+  __AKARR_IMPL(name, UNUSED static inline, akarr_val_t, akarr_len_t)    \
+  __AKARR_BULK_PROTOTYPES(name, UNUSED static inline, akarr_val_t, akarr_len_t) \
+  __AKARR_SCAN_IMPL(name, UNUSED static inline, akarr_val_t)            \
+  __AKARR_BULK_IMPL(name, UNUSED static inline, akarr_val_t, akarr_len_t, \
+                    __akarr_base_is_imm)
+
+/** Like __AKARR_TYPES, but also records (as a power of two) how many values
+ * the spilled array has room for, so that it can grow geometrically */
+#define __AKARR_GROW_TYPES(name, akarr_val_t, akarr_len_t)              \
+  typedef akarr_val_t akarr_##name##_val_t;                             \
+  typedef akarr_len_t akarr_##name##_len_t;                             \
+  typedef struct akarr_##name##_t {                                     \
+    __AKARR_STORAGE(akarr_val_t)                                        \
+    akarr_len_t cnt;                                                    \
+    /* log2 of the allocated capacity, 0 while values are stored in imm */ \
+    uint8_t cap_log2;                                                   \
+  } __attribute__((packed)) akarr_##name##_t;
+
+#define __AKARR_GROW_PROTOTYPES(name, SCOPE, akarr_val_t, akarr_len_t)  \
+  SCOPE void akarr_##name##_init(akarr_##name##_t *arrp);               \
+  SCOPE void akarr_##name##_clean_ctx(akarr_##name##_t *arrp, akarena_t *arena); \
+  SCOPE int akarr_##name##_reserve_ctx(akarr_##name##_t *arrp, akarena_t *arena, \
+                                       int n);                          \
+  SCOPE int akarr_##name##_reserve(akarr_##name##_t *arrp, int n);      \
+  SCOPE int akarr_##name##_append_ctx(akarr_##name##_t *arrp, akarena_t *arena, \
+                                      akarr_val_t val);                 \
+  SCOPE int akarr_##name##_append_n_ctx(akarr_##name##_t *arrp, akarena_t *arena, \
+                                        const akarr_val_t *vals, int n); \
+  SCOPE int akarr_##name##_truncate_ctx(akarr_##name##_t *arrp, akarena_t *arena, \
+                                        int n);                         \
+  __AKARR_CTX_PROTOTYPES(name, SCOPE, akarr_val_t)                      \
+  SCOPE void akarr_##name##_set(akarr_##name##_t *arrp, int idx, akarr_val_t val); \
+  SCOPE int akarr_##name##_capacity();                                  \
+  SCOPE int akarr_##name##_size(akarr_##name##_t *arrp);                \
+  SCOPE akarr_val_t akarr_##name##_get(akarr_##name##_t *arrp, akarr_len_t idx);
+
+#define __AKARR_GROW_IMPL(name, SCOPE, akarr_val_t, akarr_len_t)        \
+  __AKARR_IMM_IMPL(name, SCOPE, akarr_val_t)                            \
+  SCOPE void akarr_##name##_init(akarr_##name##_t *arrp)                \
+  {                                                                     \
+    assert(INT_MAX >= AKARR_CAP(akarr_len_t));                          \
+    arrp->vals = NULL;                                                  \
+    arrp->cnt = 0;                                                      \
+    arrp->cap_log2 = 0;                                                 \
+  }                                                                     \
+  SCOPE void akarr_##name##_clean_ctx(akarr_##name##_t *arrp, akarena_t *arena) \
+  {                                                                     \
+    if (arrp->cap_log2 != 0) {                                          \
+      __akarr_free(arena, arrp->vals, sizeof(akarr_val_t) << arrp->cap_log2); \
+    }                                                                   \
+    arrp->vals = NULL;                                                  \
+    arrp->cnt = 0;                                                      \
+    arrp->cap_log2 = 0;                                                 \
+  }                                                                     \
+  SCOPE int akarr_##name##_reserve_ctx(akarr_##name##_t *arrp, akarena_t *arena, \
+                                       int n)                           \
+  {                                                                     \
+    akarr_val_t *tmp;                                                   \
+    int lg = 1;                                                         \
+    if ((uint64_t)n <= (arrp->cap_log2 != 0 ?                           \
+                        (uint64_t)1 << arrp->cap_log2 :                 \
+                        AKARR_IMM_STORAGE_CNT(akarr_val_t))) {          \
+      return 0;                                                         \
+    }                                                                   \
+    if ((uint64_t)n > AKARR_CAP(akarr_len_t)) {                         \
+      return AKARR_ERR_FULL;                                            \
+    }                                                                   \
+    while (((uint64_t)1 << lg) < (uint64_t)n) {                         \
+      lg++;                                                             \
+    }                                                                   \
+    if (arrp->cap_log2 == 0) {                                          \
+      /* spill the immediate values to the heap */                      \
+      if ((tmp = __akarr_alloc(arena, sizeof(akarr_val_t) << lg)) == NULL) { \
+        return AKARR_ERR_MALLOC;                                        \
+      }                                                                 \
+      memcpy(tmp, arrp->imm, sizeof(akarr_val_t) * arrp->cnt);          \
+    } else if ((tmp = __akarr_realloc(arena, arrp->vals,                \
+                                      sizeof(akarr_val_t) << arrp->cap_log2, \
+                                      sizeof(akarr_val_t) << lg)) == NULL) { \
+      return AKARR_ERR_MALLOC;                                          \
+    }                                                                   \
+    arrp->vals = tmp;                                                   \
+    arrp->cap_log2 = lg;                                                \
+    return 0;                                                           \
+  }                                                                     \
+  SCOPE int akarr_##name##_reserve(akarr_##name##_t *arrp, int n)       \
+  {                                                                     \
+    return akarr_##name##_reserve_ctx(arrp, NULL, n);                   \
+  }                                                                     \
+  SCOPE int akarr_##name##_append_ctx(akarr_##name##_t *arrp, akarena_t *arena, \
+                                      akarr_val_t val)                  \
+  {                                                                     \
+    int ret;                                                            \
+    if (AKARR_FULL(akarr_len_t, arrp->cnt)) {                           \
+      return AKARR_ERR_FULL;                                            \
+    }                                                                   \
+    if (arrp->cap_log2 == 0 &&                                          \
+        arrp->cnt < AKARR_IMM_STORAGE_CNT(akarr_val_t)) {               \
+      __akarr_##name##_imm_set(arrp, arrp->cnt, val);                   \
+      return arrp->cnt++;                                               \
+    }                                                                   \
+    /* doubles the capacity whenever the array is full */               \
+    if ((ret = akarr_##name##_reserve_ctx(arrp, arena, arrp->cnt + 1)) != 0) { \
+      return ret;                                                       \
+    }                                                                   \
+    arrp->vals[arrp->cnt] = val;                                        \
+    return arrp->cnt++;                                                 \
+  }                                                                     \
+  SCOPE int akarr_##name##_append_n_ctx(akarr_##name##_t *arrp, akarena_t *arena, \
+                                        const akarr_val_t *vals, int n) \
+  {                                                                     \
+    int ret, idx = arrp->cnt;                                           \
+    if (n <= 0) {                                                       \
+      return idx;                                                       \
+    }                                                                   \
+    if ((uint64_t)arrp->cnt + n > AKARR_CAP(akarr_len_t)) {             \
+      return AKARR_ERR_FULL;                                            \
+    }                                                                   \
+    if ((ret = akarr_##name##_reserve_ctx(arrp, arena, arrp->cnt + n)) != 0) { \
+      return ret;                                                       \
+    }                                                                   \
+    if (arrp->cap_log2 == 0 &&                                          \
+        (size_t)arrp->cnt + n <= AKARR_IMM_STORAGE_CNT(akarr_val_t)) {  \
+      memcpy(arrp->imm + sizeof(akarr_val_t) * arrp->cnt, vals,         \
+             sizeof(akarr_val_t) * n);                                  \
+    } else {                                                            \
+      memcpy(arrp->vals + arrp->cnt, vals, sizeof(akarr_val_t) * n);    \
+    }                                                                   \
+    arrp->cnt += n;                                                     \
+    return idx;                                                         \
+  }                                                                     \
+  SCOPE int akarr_##name##_truncate_ctx(akarr_##name##_t *arrp, akarena_t *arena, \
+                                        int n)                          \
+  {                                                                     \
+    /* keeps the capacity */                                            \
+    (void)arena;                                                        \
+    if (n < 0) {                                                        \
+      n = 0;                                                            \
+    }                                                                   \
+    if (n < arrp->cnt) {                                                \
+      arrp->cnt = n;                                                    \
+    }                                                                   \
+    return 0;                                                           \
+  }                                                                     \
+  SCOPE void akarr_##name##_set(akarr_##name##_t *arrp, int idx, akarr_val_t val) \
+  {                                                                     \
+    assert(idx >= 0 && idx < arrp->cnt);                                \
+    if (arrp->cap_log2 == 0) {                                          \
+      __akarr_##name##_imm_set(arrp, idx, val);                         \
+    } else {                                                            \
+      arrp->vals[idx] = val;                                            \
+    }                                                                   \
+  }                                                                     \
+  SCOPE int akarr_##name##_capacity()                                   \
+  {                                                                     \
+    return AKARR_CAP(akarr_len_t);                                      \
+  }                                                                     \
+  SCOPE int akarr_##name##_size(akarr_##name##_t *arrp)                 \
+  {                                                                     \
+    if (arrp->cap_log2 == 0) {                                          \
+      return sizeof(akarr_##name##_t);                                  \
+    } else {                                                            \
+      return sizeof(akarr_##name##_t) + (sizeof(akarr_val_t) << arrp->cap_log2); \
+    }                                                                   \
+  }                                                                     \
+  SCOPE akarr_val_t akarr_##name##_get(akarr_##name##_t *arrp, akarr_len_t idx) \
+  {                                                                     \
+    assert(idx < arrp->cnt);                                            \
+    if (arrp->cap_log2 == 0) {                                          \
+      return __akarr_##name##_imm_get(arrp, idx);                       \
+    } else {                                                            \
+      return arrp->vals[idx];                                           \
+    }                                                                   \
+  }                                                                     \
+  __AKARR_CTX_IMPL(name, SCOPE, akarr_val_t)
+
+/** Instantiate an array that grows geometrically
+ *
+ * @param name          Name of the array type [symbol]
+ * @param akarr_val_t   Type of values
+ * @param akarr_len_t   Type of the length (an unsigned integer type)
+ *
+ * Like AKARR_INIT, values are stored in the pointer itself while they fit, but
+ * once they spill to the heap the allocation doubles whenever it fills up (so
+ * building an array of N values costs O(log N) reallocs rather than N), and
+ * akarr_reserve and akarr_append_n allocate room for many values at once. The
+ * capacity is kept as a one-byte log2 alongside the length.
+ */
+#define AKARR_INIT_GROW(name, akarr_val_t, akarr_len_t)                 \
+  __AKARR_GROW_TYPES(name, akarr_val_t, akarr_len_t)                    \
+  __AKARR_GROW_PROTOTYPES(name, UNUSED static inline, akarr_val_t, akarr_len_t) \
+  __AKARR_GROW_IMPL(name, UNUSED static inline, akarr_val_t, akarr_len_t) \
+  __AKARR_BULK_PROTOTYPES(name, UNUSED static inline, akarr_val_t, akarr_len_t) \
+  __AKARR_SCAN_IMPL(name, UNUSED static inline, akarr_val_t)            \
+  __AKARR_BULK_IMPL(name, UNUSED static inline, akarr_val_t, akarr_len_t, \
+                    __akarr_grow_is_imm)
+
+/** Intersections search the larger set for each value of the smaller one
+ * (rather than merging them) once it is this many times larger */
+#ifndef AKARR_SET_GALLOP
+#define AKARR_SET_GALLOP 16
+#endif
+
+/* Branchless binary search used by akarr_find on sorted sets */
+#define __AKARR_BSEARCH_IMPL(name, SCOPE, akarr_val_t)                  \
+  SCOPE int __akarr_##name##_lower_bound(const akarr_val_t *vals, int n, \
+                                         akarr_val_t val)               \
+  {                                                                     \
+    const akarr_val_t *base = vals;                                     \
+    int half;                                                           \
+    if (n == 0) {                                                       \
+      return 0;                                                         \
+    }                                                                   \
+    /* halve the range without branching on the comparison (the       \
+       compiler emits a conditional move), so nothing is mispredicted */ \
+    while (n > 1) {                                                     \
+      half = n / 2;                                                     \
+      base = (base[half] < val) ? base + half : base;                   \
+      n -= half;                                                        \
+    }                                                                   \
+    return (base - vals) + (*base < val);                               \
+  }                                                                     \
+  SCOPE int __akarr_##name##_search(const akarr_val_t *vals, int n,     \
+                                    akarr_val_t val)                    \
+  {                                                                     \
+    int idx = __akarr_##name##_lower_bound(vals, n, val);               \
+    return (idx < n && vals[idx] == val) ? idx : -1;                    \
+  }
+
+#define __AKARR_SET_PROTOTYPES(name, SCOPE, akarr_val_t, akarr_len_t)   \
+  SCOPE int akarr_##name##_insert_ctx(akarr_##name##_t *arrp, akarena_t *arena, \
+                                      akarr_val_t val);                 \
+  SCOPE int akarr_##name##_insert(akarr_##name##_t *arrp, akarr_val_t val); \
+  SCOPE int akarr_##name##_remove(akarr_##name##_t *arrp, akarr_val_t val); \
+  SCOPE int akarr_##name##_union_ctx(akarr_##name##_t *dst, akarena_t *arena, \
+                                     akarr_##name##_t *a, akarr_##name##_t *b); \
+  SCOPE int akarr_##name##_union(akarr_##name##_t *dst, akarr_##name##_t *a, \
+                                 akarr_##name##_t *b);                  \
+  SCOPE int akarr_##name##_intersect_ctx(akarr_##name##_t *dst,         \
+                                         akarena_t *arena,              \
+                                         akarr_##name##_t *a,           \
+                                         akarr_##name##_t *b);          \
+  SCOPE int akarr_##name##_intersect(akarr_##name##_t *dst,             \
+                                     akarr_##name##_t *a, akarr_##name##_t *b); \
+  SCOPE int akarr_##name##_intersect_count(akarr_##name##_t *a,         \
+                                           akarr_##name##_t *b);
+
+#define __AKARR_SET_IMPL(name, SCOPE, akarr_val_t, akarr_len_t)         \
+  /* get the values of a set, copying them to buf if they are immediate */ \
+  SCOPE akarr_val_t *__akarr_##name##_vals(akarr_##name##_t *arrp,      \
+                                          akarr_val_t *buf)             \
+  {                                                                     \
+    if (arrp->cap_log2 == 0) {                                          \
+      __akarr_##name##_imm_out(arrp, buf, arrp->cnt);                   \
+      return buf;                                                       \
+    }                                                                   \
+    return arrp->vals;                                                  \
+  }                                                                     \
+  /* merge two sorted sets, keeping values that appear in either */     \
+  SCOPE int __akarr_##name##_merge(const akarr_val_t *a, int na,        \
+                                   const akarr_val_t *b, int nb,        \
+                                   akarr_val_t *out)                    \
+  {                                                                     \
+    int i = 0, j = 0, k = 0;                                            \
+    akarr_val_t x, y;                                                   \
+    while (i < na && j < nb) {                                          \
+      x = a[i];                                                         \
+      y = b[j];                                                         \
+      out[k++] = (x < y) ? x : y;                                       \
+      i += (x <= y);                                                    \
+      j += (y <= x);                                                    \
+    }                                                                   \
+    memcpy(out + k, a + i, sizeof(akarr_val_t) * (na - i));             \
+    k += na - i;                                                        \
+    memcpy(out + k, b + j, sizeof(akarr_val_t) * (nb - j));             \
+    return k + (nb - j);                                                \
+  }                                                                     \
+  /* intersect two sorted sets into out (or just count if out is NULL) */ \
+  SCOPE int __akarr_##name##_isect(const akarr_val_t *a, int na,        \
+                                   const akarr_val_t *b, int nb,        \
+                                   akarr_val_t *out)                    \
+  {                                                                     \
+    const akarr_val_t *t;                                               \
+    int i = 0, j = 0, k = 0, tn;                                        \
+    akarr_val_t x, y;                                                   \
+    if (na > nb) {                                                      \
+      t = a; a = b; b = t;                                              \
+      tn = na; na = nb; nb = tn;                                        \
+    }                                                                   \
+    if ((uint64_t)na * AKARR_SET_GALLOP < (uint64_t)nb) {               \
+      /* b is much larger: binary search it for each value of a */      \
+      for (; i < na && j < nb; i++) {                                   \
+        x = a[i];                                                       \
+        j += __akarr_##name##_lower_bound(b + j, nb - j, x);            \
+        if (j < nb && b[j] == x) {                                      \
+          if (out != NULL) {                                            \
+            out[k] = x;                                                 \
+          }                                                             \
+          k++;                                                          \
+        }                                                               \
+      }                                                                 \
+      return k;                                                         \
+    }                                                                   \
+    while (i < na && j < nb) {                                          \
+      x = a[i];                                                         \
+      y = b[j];                                                         \
+      if (out != NULL) {                                                \
+        out[k] = x;                                                     \
+      }                                                                 \
+      k += (x == y);                                                    \
+      i += (x <= y);                                                    \
+      j += (y <= x);                                                    \
+    }                                                                   \
+    return k;                                                           \
+  }                                                                     \
+  SCOPE int akarr_##name##_insert_ctx(akarr_##name##_t *arrp, akarena_t *arena, \
+                                      akarr_val_t val)                  \
+  {                                                                     \
+    akarr_val_t buf[AKARR_IMM_STORAGE_CNT(akarr_val_t) + 1];            \
+    akarr_val_t *vals = __akarr_##name##_vals(arrp, buf);               \
+    int idx, ret;                                                       \
+    idx = __akarr_##name##_lower_bound(vals, arrp->cnt, val);           \
+    if (idx < arrp->cnt && vals[idx] == val) {                          \
+      return 0;                                                         \
+    }                                                                   \
+    /* make room for the value (and maybe move to the heap) first */    \
+    if ((ret = akarr_##name##_append_ctx(arrp, arena, val)) < 0) {      \
+      return ret;                                                       \
+    }                                                                   \
+    if (idx == arrp->cnt - 1) {                                         \
+      return 1;                                                         \
+    }                                                                   \
+    vals = __akarr_##name##_vals(arrp, buf);                            \
+    memmove(vals + idx + 1, vals + idx,                                 \
+            sizeof(akarr_val_t) * (arrp->cnt - 1 - idx));               \
+    vals[idx] = val;                                                    \
+    if (vals == buf) {                                                  \
+      __akarr_##name##_imm_in(arrp, buf, arrp->cnt);                    \
+    }                                                                   \
+    return 1;                                                           \
+  }                                                                     \
+  SCOPE int akarr_##name##_insert(akarr_##name##_t *arrp, akarr_val_t val) \
+  {                                                                     \
+    return akarr_##name##_insert_ctx(arrp, NULL, val);                  \
+  }                                                                     \
+  SCOPE int akarr_##name##_remove(akarr_##name##_t *arrp, akarr_val_t val) \
+  {                                                                     \
+    akarr_val_t buf[AKARR_IMM_STORAGE_CNT(akarr_val_t) + 1];            \
+    akarr_val_t *vals = __akarr_##name##_vals(arrp, buf);               \
+    int idx = __akarr_##name##_search(vals, arrp->cnt, val);            \
+    if (idx < 0) {                                                      \
+      return 0;                                                         \
+    }                                                                   \
+    memmove(vals + idx, vals + idx + 1,                                 \
+            sizeof(akarr_val_t) * (arrp->cnt - 1 - idx));               \
+    arrp->cnt--;                                                        \
+    if (vals == buf) {                                                  \
+      __akarr_##name##_imm_in(arrp, buf, arrp->cnt);                    \
+    }                                                                   \
+    return 1;                                                           \
+  }                                                                     \
+  SCOPE int akarr_##name##_union_ctx(akarr_##name##_t *dst, akarena_t *arena, \
+                                     akarr_##name##_t *a, akarr_##name##_t *b) \
+  {                                                                     \
+    akarr_val_t abuf[AKARR_IMM_STORAGE_CNT(akarr_val_t) + 1];           \
+    akarr_val_t bbuf[AKARR_IMM_STORAGE_CNT(akarr_val_t) + 1];           \
+    akarr_val_t dbuf[AKARR_IMM_STORAGE_CNT(akarr_val_t) + 1];           \
+    akarr_val_t *out;                                                   \
+    uint64_t n = (uint64_t)a->cnt + b->cnt;                             \
+    int ret;                                                            \
+    assert(dst != a && dst != b);                                       \
+    if (n > AKARR_CAP(akarr_len_t)) {                                   \
+      /* the union may still fit if enough values are shared */         \
+      n -= akarr_##name##_intersect_count(a, b);                        \
+      if (n > AKARR_CAP(akarr_len_t)) {                                 \
+        return AKARR_ERR_FULL;                                          \
+      }                                                                 \
+    }                                                                   \
+    akarr_##name##_truncate_ctx(dst, arena, 0);                         \
+    if ((ret = akarr_##name##_reserve_ctx(dst, arena, n)) != 0) {       \
+      return ret;                                                       \
+    }                                                                   \
+    out = (dst->cap_log2 == 0) ? dbuf : dst->vals;                      \
+    dst->cnt = __akarr_##name##_merge(__akarr_##name##_vals(a, abuf), a->cnt, \
+                                      __akarr_##name##_vals(b, bbuf), b->cnt, \
+                                      out);                             \
+    if (out == dbuf) {                                                  \
+      __akarr_##name##_imm_in(dst, dbuf, dst->cnt);                     \
+    }                                                                   \
+    return dst->cnt;                                                    \
+  }                                                                     \
+  SCOPE int akarr_##name##_union(akarr_##name##_t *dst, akarr_##name##_t *a, \
+                                 akarr_##name##_t *b)                   \
+  {                                                                     \
+    return akarr_##name##_union_ctx(dst, NULL, a, b);                   \
+  }                                                                     \
+  SCOPE int akarr_##name##_intersect_ctx(akarr_##name##_t *dst,         \
+                                         akarena_t *arena,              \
+                                         akarr_##name##_t *a,           \
+                                         akarr_##name##_t *b)           \
+  {                                                                     \
+    akarr_val_t abuf[AKARR_IMM_STORAGE_CNT(akarr_val_t) + 1];           \
+    akarr_val_t bbuf[AKARR_IMM_STORAGE_CNT(akarr_val_t) + 1];           \
+    akarr_val_t dbuf[AKARR_IMM_STORAGE_CNT(akarr_val_t) + 1];           \
+    akarr_val_t *out;                                                   \
+    int ret, n = (a->cnt < b->cnt) ? a->cnt : b->cnt;                   \
+    assert(dst != a && dst != b);                                       \
+    akarr_##name##_truncate_ctx(dst, arena, 0);                         \
+    if ((ret = akarr_##name##_reserve_ctx(dst, arena, n)) != 0) {       \
+      return ret;                                                       \
+    }                                                                   \
+    out = (dst->cap_log2 == 0) ? dbuf : dst->vals;                      \
+    dst->cnt = __akarr_##name##_isect(__akarr_##name##_vals(a, abuf), a->cnt, \
+                                      __akarr_##name##_vals(b, bbuf), b->cnt, \
+                                      out);                             \
+    if (out == dbuf) {                                                  \
+      __akarr_##name##_imm_in(dst, dbuf, dst->cnt);                     \
+    }                                                                   \
+    return dst->cnt;                                                    \
+  }                                                                     \
+  SCOPE int akarr_##name##_intersect(akarr_##name##_t *dst,             \
+                                     akarr_##name##_t *a, akarr_##name##_t *b) \
+  {                                                                     \
+    return akarr_##name##_intersect_ctx(dst, NULL, a, b);               \
+  }                                                                     \
+  SCOPE int akarr_##name##_intersect_count(akarr_##name##_t *a,         \
+                                           akarr_##name##_t *b)         \
+  {                                                                     \
+    akarr_val_t abuf[AKARR_IMM_STORAGE_CNT(akarr_val_t) + 1];           \
+    akarr_val_t bbuf[AKARR_IMM_STORAGE_CNT(akarr_val_t) + 1];           \
+    return __akarr_##name##_isect(__akarr_##name##_vals(a, abuf), a->cnt, \
+                                  __akarr_##name##_vals(b, bbuf), b->cnt, \
+                                  NULL);                                \
+  }
+
+/** Instantiate a set of values kept in ascending order
+ *
+ * @param name          Name of the set type [symbol]
+ * @param akarr_val_t   Type of values (an integer type)
+ * @param akarr_len_t   Type of the length (an unsigned integer type)
+ *
+ * Sets have the same layout as AKARR_INIT_GROW arrays (and all of their
+ * operations), but akarr_find and akarr_contains use binary search, and
+ * akarr_insert, akarr_remove, akarr_union and akarr_intersect keep the values
+ * sorted and unique. akarr_append, akarr_set and akarr_copy_in store values
+ * as given, so they may only be used with values that keep the set sorted
+ * (e.g. to build a set from sorted input in one pass).
+ */
+#define AKARR_INIT_SET(name, akarr_val_t, akarr_len_t)                  \
+  __AKARR_GROW_TYPES(name, akarr_val_t, akarr_len_t)                    \
+  __AKARR_GROW_PROTOTYPES(name, UNUSED static inline, akarr_val_t, akarr_len_t) \
+  __AKARR_GROW_IMPL(name, UNUSED static inline, akarr_val_t, akarr_len_t) \
+  __AKARR_BULK_PROTOTYPES(name, UNUSED static inline, akarr_val_t, akarr_len_t) \
+  __AKARR_BSEARCH_IMPL(name, UNUSED static inline, akarr_val_t)         \
+  __AKARR_BULK_IMPL(name, UNUSED static inline, akarr_val_t, akarr_len_t, \
+                    __akarr_grow_is_imm)                                \
+  __AKARR_SET_PROTOTYPES(name, UNUSED static inline, akarr_val_t, akarr_len_t) \
+  __AKARR_SET_IMPL(name, UNUSED static inline, akarr_val_t, akarr_len_t)
 
 /* Convenience macros */
 #define akarr_t(name) akarr_##name##_t
@@ -282,10 +1029,74 @@ typedef enum {
 #define akarr_init(name, arr) akarr_##name##_init(&arr)
 #define akarr_clean(name, arr) akarr_##name##_clean(&arr)
 #define akarr_append(name, arr, val) akarr_##name##_append(&arr, val)
+#define akarr_append_n(name, arr, vals, n)                              \
+  akarr_##name##_append_n(&arr, vals, n)
+#define akarr_reserve(name, arr, n) akarr_##name##_reserve(&arr, n)
+/** Shrink the array to its first n values. Returns 0, or AKARR_ERR_MALLOC
+ * (leaving the array unchanged) if its spilled storage could not be shrunk */
+#define akarr_truncate(name, arr, n) akarr_##name##_truncate(&arr, n)
 #define akarr_set(name, arr, idx, val) akarr_##name##_set(&arr, idx, val)
 #define akarr_len(arr) (arr.cnt)
 #define akarr_capacity(name) akarr_##name##_capacity()
 #define akarr_size(name, arr) akarr_##name##_size(&arr)
 #define akarr_get(name, arr, idx) akarr_##name##_get(&arr, idx)
 
+/* Variants of the allocating operations that take spilled storage from an
+ * akarena_t instead of malloc. An array must either always or never be used
+ * with the same arena, and need not be cleaned if the arena is destroyed or
+ * reset (but must then be re-initialized before it is used again). */
+#define akarr_clean_ctx(name, arr, arena) akarr_##name##_clean_ctx(&arr, arena)
+#define akarr_append_ctx(name, arr, arena, val)                         \
+  akarr_##name##_append_ctx(&arr, arena, val)
+#define akarr_append_n_ctx(name, arr, arena, vals, n)                   \
+  akarr_##name##_append_n_ctx(&arr, arena, vals, n)
+#define akarr_reserve_ctx(name, arr, arena, n)                          \
+  akarr_##name##_reserve_ctx(&arr, arena, n)
+#define akarr_truncate_ctx(name, arr, arena, n)                         \
+  akarr_##name##_truncate_ctx(&arr, arena, n)
+#define akarr_copy_in_ctx(name, arr, arena, src, n)                     \
+  akarr_##name##_copy_in_ctx(&arr, arena, src, n)
+#define akarr_sorted_insert_ctx(name, arr, arena, val)                  \
+  akarr_##name##_sorted_insert_ctx(&arr, arena, val)
+#define akarr_insert_ctx(name, set, arena, val)                         \
+  akarr_##name##_insert_ctx(&set, arena, val)
+#define akarr_union_ctx(name, dst, arena, a, b)                         \
+  akarr_##name##_union_ctx(&dst, arena, &a, &b)
+#define akarr_intersect_ctx(name, dst, arena, a, b)                     \
+  akarr_##name##_intersect_ctx(&dst, arena, &a, &b)
+
+/* Bulk operations */
+/** Copy all values of the array to dst (room for akarr_len values), and
+ * return how many were copied */
+#define akarr_copy_out(name, arr, dst) akarr_##name##_copy_out(&arr, dst)
+/** Replace the contents of the array with n values from src. Returns 0, or an
+ * akarr_err_t */
+#define akarr_copy_in(name, arr, src, n) akarr_##name##_copy_in(&arr, src, n)
+/** Get the index of the first value equal to val, or -1 */
+#define akarr_find(name, arr, val) akarr_##name##_find(&arr, val)
+/** Is there a value equal to val in the array? */
+#define akarr_contains(name, arr, val) akarr_##name##_contains(&arr, val)
+/** Insert val into an array sorted in ascending order, after any equal
+ * values. Returns the index of val, or an akarr_err_t */
+#define akarr_sorted_insert(name, arr, val)                             \
+  akarr_##name##_sorted_insert(&arr, val)
+
+/* Set operations (AKARR_INIT_SET only) */
+/** Add val to the set unless it is already there. Returns 1 if it was added,
+ * 0 if it was already present, or an akarr_err_t */
+#define akarr_insert(name, set, val) akarr_##name##_insert(&set, val)
+/** Remove val from the set. Returns 1 if it was removed, 0 if it was not
+ * present */
+#define akarr_remove(name, set, val) akarr_##name##_remove(&set, val)
+/** Replace the contents of dst (which must not be a or b) with the values in
+ * either a or b. Returns the size of dst, or an akarr_err_t */
+#define akarr_union(name, dst, a, b) akarr_##name##_union(&dst, &a, &b)
+/** Replace the contents of dst (which must not be a or b) with the values in
+ * both a and b. Returns the size of dst, or an akarr_err_t */
+#define akarr_intersect(name, dst, a, b)                                \
+  akarr_##name##_intersect(&dst, &a, &b)
+/** Count the values in both a and b, without storing them */
+#define akarr_intersect_count(name, a, b)                               \
+  akarr_##name##_intersect_count(&a, &b)
+
 #endif /* __AKARR_H */
@@ -32,14 +32,43 @@
 
 #include <assert.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#ifdef AKQ_STATS
+#include <time.h>
+#endif
 
 /** @file
  *
  * @brief Single producer, single consumer lock-free queue implementation. Based
  *  on a description from http://www.drdobbs.com/parallel/210604448
  *
+ * Also provides a bounded, array-backed, multi-producer multi-consumer queue
+ * (AKQ_MPMC_INIT) with the same interface. Based on the design by Dmitry
+ * Vyukov, each slot carries a sequence number that tells producers and
+ * consumers whether it is free or full for the current lap, so no element is
+ * ever allocated and producers only contend with each other (and consumers
+ * with each other) on a single index.
+ *
+ * For the common single producer, single consumer case, AKQ_RING_INIT gives
+ * an array-backed ring with the same interface that needs no atomic
+ * read-modify-write operations at all: each side owns one index, and keeps a
+ * cached copy of the other side's index that it only refreshes when the ring
+ * looks full (or empty).
+ *
+ * AKQ_BCAST_INIT gives a single producer, multi-consumer broadcast ring: each
+ * consumer sees every value, through its own cursor over the shared buffer,
+ * and the producer only waits for the slowest consumer.
+ *
+ * A thread that has to wait for data (or for space) first spins, then yields
+ * the CPU, and finally sleeps on a condition variable until woken by the other
+ * side (see akq_set_wait). The other side only pays for a wakeup (a mutex and
+ * a signal) when a thread is actually asleep, but every push and shift of a
+ * queue whose threads may sleep costs a memory fence. AKQ_RING_INIT queues
+ * therefore never sleep by default (see AKQ_RING_WAIT_YIELDS).
+ *
  * @author Alistair King
  *
  */
@@ -102,9 +131,326 @@ int main(int argc, char **argv)
 #  endif
 #endif
 
+/** Size of a cache line. Indexes written by different threads are padded to
+ * this to avoid false sharing */
+#ifndef AKQ_CACHELINE
+#define AKQ_CACHELINE 64
+#endif
+
+/** Hint to the CPU that we are busy-waiting */
+#if defined(__x86_64__) || defined(__i386__)
+#define __akq_relax() __asm__ __volatile__("pause" ::: "memory")
+#else
+#define __akq_relax() __asm__ __volatile__("" ::: "memory")
+#endif
+
+/** Default number of busy-wait iterations before a waiting thread starts to
+ * yield the CPU */
+#ifndef AKQ_WAIT_SPINS
+#define AKQ_WAIT_SPINS 128
+#endif
+
+/** Default number of times a waiting thread yields the CPU before it sleeps */
+#ifndef AKQ_WAIT_YIELDS
+#define AKQ_WAIT_YIELDS 16
+#endif
+
+/** Pass as the number of yields to akq_set_wait to never sleep */
+#define AKQ_NO_PARK UINT32_MAX
+
+/** Default number of yields for AKQ_RING_INIT queues. They never sleep unless
+ * told otherwise, so that their pushes and shifts need no memory fence */
+#ifndef AKQ_RING_WAIT_YIELDS
+#define AKQ_RING_WAIT_YIELDS AKQ_NO_PARK
+#endif
+
+/** A wait strategy, along with what is needed to sleep and be woken up */
+typedef struct akq_wait {
+  uint32_t spins;
+  uint32_t yields;
+  /** Whether waiters may sleep (set only while the queue is idle) */
+  int park;
+  /** Number of threads sleeping on cond */
+  int sleepers;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+} akq_wait_t;
+
+UNUSED static inline void __akq_wait_init(akq_wait_t *w)
+{
+  w->spins = AKQ_WAIT_SPINS;
+  w->yields = AKQ_WAIT_YIELDS;
+  w->park = 1;
+  w->sleepers = 0;
+  pthread_mutex_init(&w->lock, NULL);
+  pthread_cond_init(&w->cond, NULL);
+}
+
+UNUSED static inline void __akq_wait_destroy(akq_wait_t *w)
+{
+  pthread_mutex_destroy(&w->lock);
+  pthread_cond_destroy(&w->cond);
+}
+
+UNUSED static inline void __akq_wait_set(akq_wait_t *w, uint32_t spins,
+                                         uint32_t yields)
+{
+  w->spins = spins;
+  w->yields = yields;
+  w->park = yields != AKQ_NO_PARK;
+}
+
+/** Wait until ready is true: spin, then yield, then sleep until woken by
+ * __akq_wake. ready must only read memory that the waking side publishes
+ * before it calls __akq_wake. */
+#define __akq_wait_until(w, ready)                                      \
+  do {                                                                  \
+    uint32_t __n = 0;                                                   \
+    while (!(ready)) {                                                  \
+      if (__n < (w)->spins) {                                           \
+        __akq_relax();                                                  \
+      } else if (!(w)->park || __n - (w)->spins < (w)->yields) {        \
+        sched_yield();                                                  \
+      } else {                                                          \
+        pthread_mutex_lock(&(w)->lock);                                 \
+        __atomic_add_fetch(&(w)->sleepers, 1, __ATOMIC_SEQ_CST);        \
+        /* pairs with the fence in __akq_wake */                        \
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);                        \
+        while (!(ready)) {                                              \
+          pthread_cond_wait(&(w)->cond, &(w)->lock);                    \
+        }                                                               \
+        __atomic_sub_fetch(&(w)->sleepers, 1, __ATOMIC_SEQ_CST);        \
+        pthread_mutex_unlock(&(w)->lock);                               \
+        break;                                                          \
+      }                                                                 \
+      __n++;                                                            \
+    }                                                                   \
+  } while (0)
+
+/** Wake all threads sleeping in __akq_wait_until, if any. Must be called
+ * after publishing whatever they are waiting for */
+UNUSED static inline void __akq_wake(akq_wait_t *w)
+{
+  if (!w->park) {
+    return;
+  }
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&w->sleepers, __ATOMIC_RELAXED) != 0) {
+    pthread_mutex_lock(&w->lock);
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+  }
+}
+
+/** Round up to the next power of two (at least 2) */
+UNUSED static inline uint64_t __akq_pow2(uint64_t x)
+{
+  uint64_t p = 2;
+  while (p < x) {
+    p <<= 1;
+  }
+  return p;
+}
+
+/*
+  With AKQ_STATS defined (consistently, in every file that uses a given queue
+  type), each queue counts the values pushed and shifted and the times either
+  side had to wait, tracks its high-water mark, and times one in every
+  AKQ_STATS_SAMPLE values from push to shift; see akq_stats(). Producer and
+  consumer counters live on separate cache lines, but updating them still
+  costs an atomic add per operation (and a clock read per sampled value).
+ */
+
+/** Number of buckets in the latency histogram of akq_stats_t */
+#define AKQ_STATS_BUCKETS 32
+
+/** Time one in every AKQ_STATS_SAMPLE values (a power of two) */
+#ifndef AKQ_STATS_SAMPLE
+#define AKQ_STATS_SAMPLE 64
+#endif
+
+/** Statistics about a queue, filled by akq_stats() */
+typedef struct akq_stats {
+  /** Number of values pushed */
+  uint64_t pushes;
+  /** Number of values shifted (for a broadcast queue, by all consumers: each
+   * value is counted once per consumer that shifts it) */
+  uint64_t shifts;
+  /** Number of times a blocking push found the queue full and waited */
+  uint64_t full_waits;
+  /** Total time spent in those waits (ns) */
+  uint64_t full_wait_ns;
+  /** Number of times a blocking shift found the queue empty and waited */
+  uint64_t empty_waits;
+  /** Total time spent in those waits (ns) */
+  uint64_t empty_wait_ns;
+  /** Largest number of values seen in the queue by a producer */
+  uint32_t high_water;
+  /** Number of sampled values that spent [2^i, 2^(i+1)) ns between push and
+   * shift (the first bucket also counts faster ones, the last slower ones).
+   * For a broadcast queue, each consumer's shift of a sampled value adds one
+   * count, so the histogram covers all consumers together */
+  uint64_t latency[AKQ_STATS_BUCKETS];
+} akq_stats_t;
+
+#ifdef AKQ_STATS
+/* producer and consumer counters, kept apart to avoid false sharing */
+typedef struct __akq_stats_ctr {
+  uint64_t pushes;
+  uint64_t full_waits;
+  uint64_t full_wait_ns;
+  uint32_t high_water;
+  uint64_t shifts __attribute__((aligned(AKQ_CACHELINE)));
+  uint64_t empty_waits;
+  uint64_t empty_wait_ns;
+  uint64_t latency[AKQ_STATS_BUCKETS];
+} __attribute__((aligned(AKQ_CACHELINE))) __akq_stats_ctr_t;
+
+UNUSED static inline uint64_t __akq_now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+UNUSED static inline void __akq_stats_add_pushed(__akq_stats_ctr_t *s,
+                                                 uint64_t n, int64_t depth)
+{
+  uint32_t hw = __atomic_load_n(&s->high_water, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&s->pushes, n, __ATOMIC_RELAXED);
+  while (depth > (int64_t)hw &&
+         !__atomic_compare_exchange_n(&s->high_water, &hw, (uint32_t)depth, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+}
+
+UNUSED static inline void __akq_stats_add_latency(__akq_stats_ctr_t *s,
+                                                  uint64_t stamp)
+{
+  uint64_t ns;
+  int b;
+  if (stamp == 0) {
+    return; /* not sampled */
+  }
+  ns = __akq_now_ns() - stamp;
+  b = ns < 2 ? 0 : 63 - __builtin_clzll(ns);
+  if (b >= AKQ_STATS_BUCKETS) {
+    b = AKQ_STATS_BUCKETS - 1;
+  }
+  __atomic_add_fetch(&s->latency[b], 1, __ATOMIC_RELAXED);
+}
+
+UNUSED static inline void __akq_stats_fill(__akq_stats_ctr_t *s,
+                                           akq_stats_t *st)
+{
+  int i;
+  st->pushes = __atomic_load_n(&s->pushes, __ATOMIC_RELAXED);
+  st->shifts = __atomic_load_n(&s->shifts, __ATOMIC_RELAXED);
+  st->full_waits = __atomic_load_n(&s->full_waits, __ATOMIC_RELAXED);
+  st->full_wait_ns = __atomic_load_n(&s->full_wait_ns, __ATOMIC_RELAXED);
+  st->empty_waits = __atomic_load_n(&s->empty_waits, __ATOMIC_RELAXED);
+  st->empty_wait_ns = __atomic_load_n(&s->empty_wait_ns, __ATOMIC_RELAXED);
+  st->high_water = __atomic_load_n(&s->high_water, __ATOMIC_RELAXED);
+  for (i = 0; i < AKQ_STATS_BUCKETS; i++) {
+    st->latency[i] = __atomic_load_n(&s->latency[i], __ATOMIC_RELAXED);
+  }
+}
+
+#define __AKQ_STATS_FIELDS __akq_stats_ctr_t stats;
+#define __AKQ_STATS_STAMP uint64_t stamp;
+#define __AKQ_STATS_START(t) uint64_t t = __akq_now_ns();
+/* a side (full or empty) finished waiting, having started at t */
+#define __akq_stats_waited(q, side, t)                                  \
+  (__atomic_add_fetch(&(q)->stats.side##_waits, 1, __ATOMIC_RELAXED),   \
+   __atomic_add_fetch(&(q)->stats.side##_wait_ns, __akq_now_ns() - (t), \
+                      __ATOMIC_RELAXED))
+/* n values were pushed, leaving (about) depth values in the queue */
+#define __akq_stats_pushed(q, n, depth)                 \
+  __akq_stats_add_pushed(&(q)->stats, n, (int64_t)(depth))
+#define __akq_stats_shifted(q, n)                                       \
+  __atomic_add_fetch(&(q)->stats.shifts, n, __ATOMIC_RELAXED)
+/* stamp the value pushed at position pos, if it is sampled */
+#define __akq_stats_stamp(slot, pos)                                    \
+  ((slot)->stamp = ((pos) & (AKQ_STATS_SAMPLE - 1)) ? 0 : __akq_now_ns())
+#define __akq_stats_latency(q, slot)                    \
+  __akq_stats_add_latency(&(q)->stats, (slot)->stamp)
+#define __akq_stats_get(q, st) __akq_stats_fill(&(q)->stats, st)
+#else
+#define __AKQ_STATS_FIELDS
+#define __AKQ_STATS_STAMP
+#define __AKQ_STATS_START(t)
+#define __akq_stats_waited(q, side, t) ((void)0)
+#define __akq_stats_pushed(q, n, depth) ((void)0)
+#define __akq_stats_shifted(q, n) ((void)0)
+#define __akq_stats_stamp(slot, pos) ((void)0)
+#define __akq_stats_latency(q, slot) ((void)0)
+#define __akq_stats_get(q, st) ((void)(q), memset(st, 0, sizeof(akq_stats_t)))
+#endif
+
+#define __AKQ_STATS_IMPL(name, SCOPE)                                   \
+  SCOPE void akq_##name##_stats(akq_##name##_t *q, akq_stats_t *st)     \
+  {                                                                     \
+    __akq_stats_get(q, st);                                             \
+  }
+
+/* The single-element and blocking batch operations, in terms of
+ * akq_##name##_try_push_n, akq_##name##_try_shift_n and the
+ * __akq_##name##_can_push/can_shift predicates of each queue variant. sp is 1
+ * if the queue has a single producer, in which case the free space cannot
+ * shrink while it pushes, so a push that makes no progress although there is
+ * room has failed (e.g., a node could not be allocated) */
+#define __AKQ_BATCH_PUSH_IMPL(name, SCOPE, akqval_t, sp)                \
+  SCOPE int akq_##name##_try_push(akq_##name##_t *q, akqval_t val)      \
+  {                                                                     \
+    return akq_##name##_try_push_n(q, &val, 1) == 1 ? 0 : -1;           \
+  }                                                                     \
+  SCOPE int akq_##name##_push_n(akq_##name##_t *q, const akqval_t *vals, \
+                                uint32_t n)                             \
+  {                                                                     \
+    uint32_t k, done = 0;                                               \
+    while (done < n) {                                                  \
+      if ((k = akq_##name##_try_push_n(q, vals + done, n - done)) == 0) { \
+        if ((sp) && __akq_##name##_can_push(q) &&                       \
+            (k = akq_##name##_try_push_n(q, vals + done, n - done)) == 0) { \
+          return -1;                                                    \
+        }                                                               \
+      }                                                                 \
+      if (k == 0) {                                                     \
+        __AKQ_STATS_START(t0)                                           \
+        __akq_wait_until(&q->not_full, __akq_##name##_can_push(q));     \
+        __akq_stats_waited(q, full, t0);                                \
+      }                                                                 \
+      done += k;                                                        \
+    }                                                                   \
+    return 0;                                                           \
+  }
+
+#define __AKQ_BATCH_SHIFT_IMPL(name, SCOPE, akqval_t)                   \
+  SCOPE int akq_##name##_try_shift(akq_##name##_t *q, akqval_t *val)    \
+  {                                                                     \
+    return akq_##name##_try_shift_n(q, val, 1) == 1 ? 0 : -1;           \
+  }                                                                     \
+  SCOPE uint32_t akq_##name##_shift_n(akq_##name##_t *q, akqval_t *vals, \
+                                      uint32_t n)                       \
+  {                                                                     \
+    uint32_t k;                                                         \
+    if (n == 0) { return 0; }                                           \
+    while ((k = akq_##name##_try_shift_n(q, vals, n)) == 0) {           \
+      __AKQ_STATS_START(t0)                                             \
+      __akq_wait_until(&q->not_empty, __akq_##name##_can_shift(q));     \
+      __akq_stats_waited(q, empty, t0);                                 \
+    }                                                                   \
+    return k;                                                           \
+  }
+
+#define __AKQ_BATCH_IMPL(name, SCOPE, akqval_t, sp)     \
+  __AKQ_BATCH_PUSH_IMPL(name, SCOPE, akqval_t, sp)      \
+  __AKQ_BATCH_SHIFT_IMPL(name, SCOPE, akqval_t)
+
 #define __AKQ_TYPES(name, akqval_t)             \
   typedef struct akq_##name##_node {            \
     akqval_t value;                             \
+    __AKQ_STATS_STAMP                           \
     struct akq_##name##_node *next;             \
   } akq_##name##_node_t;                        \
   typedef struct {                              \
@@ -112,6 +458,9 @@ int main(int argc, char **argv)
     akq_##name##_node_t *divider;               \
     akq_##name##_node_t *last;                  \
     uint32_t size;                              \
+    akq_wait_t not_empty;                       \
+    akq_wait_t not_full;                        \
+    __AKQ_STATS_FIELDS                          \
     /** @todo consider adding a pool of unused nodes */ \
   } akq_##name##_t;
 
@@ -120,6 +469,20 @@ int main(int argc, char **argv)
   SCOPE void akq_##name##_destroy(akq_##name##_t *q);                   \
   SCOPE int akq_##name##_push(akq_##name##_t *q, akqval_t val);         \
   SCOPE akqval_t akq_##name##_shift(akq_##name##_t *q);                 \
+  SCOPE uint32_t akq_##name##_count(akq_##name##_t *q);                 \
+  SCOPE void akq_##name##_set_wait(akq_##name##_t *q, uint32_t spins,   \
+                                   uint32_t yields);                    \
+  SCOPE int akq_##name##_try_push(akq_##name##_t *q, akqval_t val);     \
+  SCOPE int akq_##name##_try_shift(akq_##name##_t *q, akqval_t *val);   \
+  SCOPE int akq_##name##_push_n(akq_##name##_t *q, const akqval_t *vals, \
+                                uint32_t n);                            \
+  SCOPE uint32_t akq_##name##_shift_n(akq_##name##_t *q, akqval_t *vals, \
+                                      uint32_t n);                      \
+  SCOPE uint32_t akq_##name##_try_push_n(akq_##name##_t *q,             \
+                                         const akqval_t *vals, uint32_t n); \
+  SCOPE uint32_t akq_##name##_try_shift_n(akq_##name##_t *q,            \
+                                          akqval_t *vals, uint32_t n);  \
+  SCOPE void akq_##name##_stats(akq_##name##_t *q, akq_stats_t *st);    \
   SCOPE akq_##name##_node_t *__akq_##name##_node_create();              \
   SCOPE void __akq_##name##_node_destroy(akq_##name##_node_t *node);
 
@@ -128,6 +491,9 @@ int main(int argc, char **argv)
   {                                                                     \
     akq_##name##_t *q = malloc(sizeof(akq_##name##_t));                 \
     if (q == NULL) { return NULL; }                                     \
+    memset(q, 0, sizeof(akq_##name##_t));                               \
+    __akq_wait_init(&q->not_empty);                                     \
+    __akq_wait_init(&q->not_full);                                      \
     q->first = q->divider = q->last = __akq_##name##_node_create();     \
     if (q->first == NULL) { akq_##name##_destroy(q); return NULL; }     \
     q->size = 0;                                                        \
@@ -141,6 +507,8 @@ int main(int argc, char **argv)
       q->first = tmp->next;                                             \
       __akq_##name##_node_destroy(tmp);                                 \
     }                                                                   \
+    __akq_wait_destroy(&q->not_empty);                                  \
+    __akq_wait_destroy(&q->not_full);                                   \
     free(q);                                                            \
   }                                                                     \
   SCOPE int akq_##name##_push(akq_##name##_t *q, akqval_t val)          \
@@ -148,17 +516,23 @@ int main(int argc, char **argv)
     akq_##name##_node_t *node;                                          \
     /* don't write too much data */                                     \
     if (q->size >= maxsize) {                                           \
-      do { sched_yield(); } while (q->size >= maxsize * 3/4);           \
+      __AKQ_STATS_START(t0)                                             \
+      __akq_wait_until(&q->not_full, q->size < maxsize * 3/4);          \
+      __akq_stats_waited(q, full, t0);                                  \
     }                                                                   \
     __sync_fetch_and_add(&q->size, 1); /* increment queue size */       \
     if ((node = __akq_##name##_node_create()) == NULL) {                \
+      __sync_fetch_and_sub(&q->size, 1);                                \
       return -1;                                                        \
     }                                                                   \
     node->value = (val);                                                \
+    __akq_stats_stamp(node, q->stats.pushes);                           \
+    __akq_stats_pushed(q, 1, q->size);                                  \
     q->last->next = node;                                               \
     if (!__sync_bool_compare_and_swap(&q->last, q->last, q->last->next)) { \
       return -1; /* failed to write to last */                          \
     }                                                                   \
+    __akq_wake(&q->not_empty);                                          \
     while (q->first != q->divider) { /* Recover used nodes */           \
       node = q->first;                                                  \
       if (!__sync_bool_compare_and_swap(&q->first, q->first,            \
@@ -172,18 +546,63 @@ int main(int argc, char **argv)
   SCOPE akqval_t akq_##name##_shift(akq_##name##_t *q)                  \
   {                                                                     \
     akq_##name##_node_t *node;                                          \
-    while (q->divider == q->last) { /* queue is empty */                \
-      pthread_yield();                                                  \
+    /* wait while the queue is empty */                                 \
+    if (q->divider == q->last) {                                        \
+      __AKQ_STATS_START(t0)                                             \
+      __akq_wait_until(&q->not_empty, q->divider != q->last);           \
+      __akq_stats_waited(q, empty, t0);                                 \
     }                                                                   \
     assert(q->divider != q->last);                                      \
     node = q->divider->next;                                            \
+    __akq_stats_latency(q, node);                                       \
+    __akq_stats_shifted(q, 1);                                          \
     if (!__sync_bool_compare_and_swap(&q->divider, q->divider,          \
                                       q->divider->next)) {              \
       assert(0); /* failed to write to divider */                       \
     }                                                                   \
-    __sync_fetch_and_sub(&q->size, 1);                                  \
+    if (__sync_sub_and_fetch(&q->size, 1) < maxsize * 3/4) {            \
+      __akq_wake(&q->not_full);                                         \
+    }                                                                   \
     return node->value;                                                 \
   }                                                                     \
+  SCOPE uint32_t akq_##name##_count(akq_##name##_t *q)                  \
+  {                                                                     \
+    return q->size;                                                     \
+  }                                                                     \
+  SCOPE void akq_##name##_set_wait(akq_##name##_t *q, uint32_t spins,   \
+                                   uint32_t yields)                     \
+  {                                                                     \
+    __akq_wait_set(&q->not_empty, spins, yields);                       \
+    __akq_wait_set(&q->not_full, spins, yields);                        \
+  }                                                                     \
+  SCOPE int __akq_##name##_can_push(akq_##name##_t *q)                  \
+  {                                                                     \
+    return q->size < maxsize * 3/4;                                     \
+  }                                                                     \
+  SCOPE int __akq_##name##_can_shift(akq_##name##_t *q)                 \
+  {                                                                     \
+    return q->divider != q->last;                                       \
+  }                                                                     \
+  SCOPE uint32_t akq_##name##_try_push_n(akq_##name##_t *q,             \
+                                         const akqval_t *vals, uint32_t n) \
+  {                                                                     \
+    uint32_t i;                                                         \
+    for (i = 0; i < n && q->size < maxsize; i++) {                      \
+      if (akq_##name##_push(q, vals[i]) != 0) { break; }                \
+    }                                                                   \
+    return i;                                                           \
+  }                                                                     \
+  SCOPE uint32_t akq_##name##_try_shift_n(akq_##name##_t *q,            \
+                                          akqval_t *vals, uint32_t n)   \
+  {                                                                     \
+    uint32_t i;                                                         \
+    for (i = 0; i < n && __akq_##name##_can_shift(q); i++) {            \
+      vals[i] = akq_##name##_shift(q);                                  \
+    }                                                                   \
+    return i;                                                           \
+  }                                                                     \
+  __AKQ_BATCH_IMPL(name, SCOPE, akqval_t, 1)                            \
+  __AKQ_STATS_IMPL(name, SCOPE)                                         \
   SCOPE akq_##name##_node_t *__akq_##name##_node_create()               \
   {                                                                     \
     akq_##name##_node_t *node;                                          \
@@ -208,6 +627,691 @@ int main(int argc, char **argv)
 #define AKQ_INIT(name, akqval_t, maxsize)                       \
   __AKQ_INIT(name, UNUSED static inline, akqval_t, maxsize)
 
+#define __AKQ_MPMC_TYPES(name, akqval_t)                                \
+  typedef struct {                                                      \
+    uint64_t seq;                                                       \
+    akqval_t value;                                                     \
+    __AKQ_STATS_STAMP                                                   \
+  } akq_##name##_slot_t;                                                \
+  typedef struct {                                                      \
+    akq_##name##_slot_t *slots;                                         \
+    uint64_t mask;                                                      \
+    /* next slot to push to, shared by all producers */                 \
+    uint64_t tail __attribute__((aligned(AKQ_CACHELINE)));              \
+    /* next slot to shift from, shared by all consumers */              \
+    uint64_t head __attribute__((aligned(AKQ_CACHELINE)));              \
+    akq_wait_t not_empty __attribute__((aligned(AKQ_CACHELINE)));       \
+    akq_wait_t not_full;                                                \
+    __AKQ_STATS_FIELDS                                                  \
+  } __attribute__((aligned(AKQ_CACHELINE))) akq_##name##_t;
+
+#define __AKQ_MPMC_PROTOTYPES(name, SCOPE, akqval_t)                    \
+  SCOPE akq_##name##_t *akq_##name##_create();                          \
+  SCOPE void akq_##name##_destroy(akq_##name##_t *q);                   \
+  SCOPE int akq_##name##_push(akq_##name##_t *q, akqval_t val);         \
+  SCOPE akqval_t akq_##name##_shift(akq_##name##_t *q);                 \
+  SCOPE uint32_t akq_##name##_count(akq_##name##_t *q);                 \
+  SCOPE void akq_##name##_set_wait(akq_##name##_t *q, uint32_t spins,   \
+                                   uint32_t yields);                    \
+  SCOPE int akq_##name##_try_push(akq_##name##_t *q, akqval_t val);     \
+  SCOPE int akq_##name##_try_shift(akq_##name##_t *q, akqval_t *val);   \
+  SCOPE int akq_##name##_push_n(akq_##name##_t *q, const akqval_t *vals, \
+                                uint32_t n);                            \
+  SCOPE uint32_t akq_##name##_shift_n(akq_##name##_t *q, akqval_t *vals, \
+                                      uint32_t n);                      \
+  SCOPE uint32_t akq_##name##_try_push_n(akq_##name##_t *q,             \
+                                         const akqval_t *vals, uint32_t n); \
+  SCOPE uint32_t akq_##name##_try_shift_n(akq_##name##_t *q,            \
+                                          akqval_t *vals, uint32_t n);  \
+  SCOPE void akq_##name##_stats(akq_##name##_t *q, akq_stats_t *st);
+
+#define __AKQ_MPMC_IMPL(name, SCOPE, akqval_t, maxsize)                 \
+  SCOPE akq_##name##_t *akq_##name##_create()                           \
+  {                                                                     \
+    akq_##name##_t *q;                                                  \
+    void *mem;                                                          \
+    uint64_t i, size = __akq_pow2(maxsize);                             \
+    if (posix_memalign(&mem, AKQ_CACHELINE, sizeof(akq_##name##_t)) != 0) { \
+      return NULL;                                                      \
+    }                                                                   \
+    q = mem;                                                            \
+    memset(q, 0, sizeof(akq_##name##_t));                               \
+    __akq_wait_init(&q->not_empty);                                     \
+    __akq_wait_init(&q->not_full);                                      \
+    if (posix_memalign(&mem, AKQ_CACHELINE,                             \
+                       size * sizeof(akq_##name##_slot_t)) != 0) {      \
+      akq_##name##_destroy(q);                                          \
+      return NULL;                                                      \
+    }                                                                   \
+    q->slots = mem;                                                     \
+    q->mask = size - 1;                                                 \
+    for (i = 0; i < size; i++) {                                        \
+      q->slots[i].seq = i;                                              \
+    }                                                                   \
+    return q;                                                           \
+  }                                                                     \
+  SCOPE void akq_##name##_destroy(akq_##name##_t *q)                    \
+  {                                                                     \
+    if (q == NULL) { return; }                                          \
+    free(q->slots);                                                     \
+    __akq_wait_destroy(&q->not_empty);                                  \
+    __akq_wait_destroy(&q->not_full);                                   \
+    free(q);                                                            \
+    /* user is responsible for freeing all values if needed */          \
+  }                                                                     \
+  SCOPE int akq_##name##_push(akq_##name##_t *q, akqval_t val)          \
+  {                                                                     \
+    akq_##name##_slot_t *slot;                                          \
+    uint64_t pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);         \
+    int64_t diff;                                                       \
+    for (;;) {                                                          \
+      slot = &q->slots[pos & q->mask];                                  \
+      diff = (int64_t)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos); \
+      if (diff == 0) { /* slot is free for this lap, try to claim it */ \
+        if (__atomic_compare_exchange_n(&q->tail, &pos, pos + 1, 1,     \
+                                        __ATOMIC_RELAXED,               \
+                                        __ATOMIC_RELAXED)) {            \
+          break;                                                        \
+        }                                                               \
+      } else if (diff < 0) { /* queue is full */                        \
+        __AKQ_STATS_START(t0)                                           \
+        __akq_wait_until(&q->not_full,                                  \
+                         (int64_t)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) \
+                                   - pos) >= 0);                        \
+        __akq_stats_waited(q, full, t0);                                \
+        pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);              \
+      } else { /* another producer took it */                           \
+        pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);              \
+      }                                                                 \
+    }                                                                   \
+    slot->value = val;                                                  \
+    __akq_stats_stamp(slot, pos);                                       \
+    __akq_stats_pushed(q, 1, pos + 1 - __atomic_load_n(&q->head, __ATOMIC_RELAXED)); \
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);            \
+    __akq_wake(&q->not_empty);                                          \
+    return 0;                                                           \
+  }                                                                     \
+  SCOPE akqval_t akq_##name##_shift(akq_##name##_t *q)                  \
+  {                                                                     \
+    akq_##name##_slot_t *slot;                                          \
+    akqval_t val;                                                       \
+    uint64_t pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);         \
+    int64_t diff;                                                       \
+    for (;;) {                                                          \
+      slot = &q->slots[pos & q->mask];                                  \
+      diff = (int64_t)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - (pos + 1)); \
+      if (diff == 0) { /* slot is full for this lap, try to claim it */ \
+        if (__atomic_compare_exchange_n(&q->head, &pos, pos + 1, 1,     \
+                                        __ATOMIC_RELAXED,               \
+                                        __ATOMIC_RELAXED)) {            \
+          break;                                                        \
+        }                                                               \
+      } else if (diff < 0) { /* queue is empty */                       \
+        __AKQ_STATS_START(t0)                                           \
+        __akq_wait_until(&q->not_empty,                                 \
+                         (int64_t)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) \
+                                   - (pos + 1)) >= 0);                  \
+        __akq_stats_waited(q, empty, t0);                               \
+        pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);              \
+      } else { /* another consumer took it */                           \
+        pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);              \
+      }                                                                 \
+    }                                                                   \
+    val = slot->value;                                                  \
+    __akq_stats_latency(q, slot);                                       \
+    __akq_stats_shifted(q, 1);                                          \
+    /* hand the slot back to producers for the next lap */              \
+    __atomic_store_n(&slot->seq, pos + q->mask + 1, __ATOMIC_RELEASE);  \
+    __akq_wake(&q->not_full);                                           \
+    return val;                                                         \
+  }                                                                     \
+  SCOPE int __akq_##name##_can_push(akq_##name##_t *q)                  \
+  {                                                                     \
+    uint64_t pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);         \
+    return (int64_t)(__atomic_load_n(&q->slots[pos & q->mask].seq,      \
+                                     __ATOMIC_ACQUIRE) - pos) >= 0;     \
+  }                                                                     \
+  SCOPE int __akq_##name##_can_shift(akq_##name##_t *q)                 \
+  {                                                                     \
+    uint64_t pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);         \
+    return (int64_t)(__atomic_load_n(&q->slots[pos & q->mask].seq,      \
+                                     __ATOMIC_ACQUIRE) - (pos + 1)) >= 0; \
+  }                                                                     \
+  SCOPE uint32_t akq_##name##_try_push_n(akq_##name##_t *q,             \
+                                         const akqval_t *vals, uint32_t n) \
+  {                                                                     \
+    uint64_t pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);         \
+    uint32_t i, k;                                                      \
+    if (n > q->mask + 1) { n = q->mask + 1; }                           \
+    for (;;) {                                                          \
+      /* count the slots after pos that are free for this lap... */     \
+      for (k = 0; k < n; k++) {                                         \
+        if (__atomic_load_n(&q->slots[(pos + k) & q->mask].seq,         \
+                            __ATOMIC_ACQUIRE) != pos + k) {             \
+          break;                                                        \
+        }                                                               \
+      }                                                                 \
+      if (k == 0) {                                                     \
+        if ((int64_t)(__atomic_load_n(&q->slots[pos & q->mask].seq,     \
+                                      __ATOMIC_ACQUIRE) - pos) < 0) {   \
+          return 0; /* queue is full */                                 \
+        }                                                               \
+        pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);              \
+        continue;                                                       \
+      }                                                                 \
+      /* ...and claim them all at once */                               \
+      if (__atomic_compare_exchange_n(&q->tail, &pos, pos + k, 1,       \
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) { \
+        break;                                                          \
+      }                                                                 \
+    }                                                                   \
+    __akq_stats_pushed(q, k, pos + k - __atomic_load_n(&q->head, __ATOMIC_RELAXED)); \
+    for (i = 0; i < k; i++) {                                           \
+      q->slots[(pos + i) & q->mask].value = vals[i];                    \
+      __akq_stats_stamp(&q->slots[(pos + i) & q->mask], pos + i);       \
+      __atomic_store_n(&q->slots[(pos + i) & q->mask].seq, pos + i + 1, \
+                       __ATOMIC_RELEASE);                               \
+    }                                                                   \
+    __akq_wake(&q->not_empty);                                          \
+    return k;                                                           \
+  }                                                                     \
+  SCOPE uint32_t akq_##name##_try_shift_n(akq_##name##_t *q,            \
+                                          akqval_t *vals, uint32_t n)   \
+  {                                                                     \
+    uint64_t pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);         \
+    uint32_t i, k;                                                      \
+    if (n > q->mask + 1) { n = q->mask + 1; }                           \
+    for (;;) {                                                          \
+      for (k = 0; k < n; k++) {                                         \
+        if (__atomic_load_n(&q->slots[(pos + k) & q->mask].seq,         \
+                            __ATOMIC_ACQUIRE) != pos + k + 1) {         \
+          break;                                                        \
+        }                                                               \
+      }                                                                 \
+      if (k == 0) {                                                     \
+        if ((int64_t)(__atomic_load_n(&q->slots[pos & q->mask].seq,     \
+                                      __ATOMIC_ACQUIRE) - (pos + 1)) < 0) { \
+          return 0; /* queue is empty */                                \
+        }                                                               \
+        pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);              \
+        continue;                                                       \
+      }                                                                 \
+      if (__atomic_compare_exchange_n(&q->head, &pos, pos + k, 1,       \
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) { \
+        break;                                                          \
+      }                                                                 \
+    }                                                                   \
+    for (i = 0; i < k; i++) {                                           \
+      vals[i] = q->slots[(pos + i) & q->mask].value;                    \
+      __akq_stats_latency(q, &q->slots[(pos + i) & q->mask]);           \
+      __atomic_store_n(&q->slots[(pos + i) & q->mask].seq,              \
+                       pos + i + q->mask + 1, __ATOMIC_RELEASE);        \
+    }                                                                   \
+    __akq_stats_shifted(q, k);                                          \
+    __akq_wake(&q->not_full);                                           \
+    return k;                                                           \
+  }                                                                     \
+  __AKQ_BATCH_IMPL(name, SCOPE, akqval_t, 0)                            \
+  __AKQ_STATS_IMPL(name, SCOPE)                                         \
+  SCOPE uint32_t akq_##name##_count(akq_##name##_t *q)                  \
+  {                                                                     \
+    uint64_t head = __atomic_load_n(&q->head, __ATOMIC_RELAXED);        \
+    uint64_t tail = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);        \
+    return tail > head ? (uint32_t)(tail - head) : 0;                   \
+  }                                                                     \
+  SCOPE void akq_##name##_set_wait(akq_##name##_t *q, uint32_t spins,   \
+                                   uint32_t yields)                     \
+  {                                                                     \
+    __akq_wait_set(&q->not_empty, spins, yields);                       \
+    __akq_wait_set(&q->not_full, spins, yields);                        \
+  }
+
+#define __AKQ_MPMC_INIT(name, SCOPE, akqval_t, maxsize) \
+  __AKQ_MPMC_TYPES(name, akqval_t)                      \
+  __AKQ_MPMC_PROTOTYPES(name, SCOPE, akqval_t)          \
+  __AKQ_MPMC_IMPL(name, SCOPE, akqval_t, maxsize)
+
+#define __AKQ_RING_TYPES(name, akqval_t)                                \
+  typedef struct {                                                      \
+    akqval_t value;                                                     \
+    __AKQ_STATS_STAMP                                                   \
+  } akq_##name##_slot_t;                                                \
+  typedef struct {                                                      \
+    akq_##name##_slot_t *slots;                                         \
+    uint64_t mask;                                                      \
+    /* written by the producer only */                                  \
+    uint64_t tail __attribute__((aligned(AKQ_CACHELINE)));              \
+    uint64_t head_cache;                                                \
+    /* written by the consumer only */                                  \
+    uint64_t head __attribute__((aligned(AKQ_CACHELINE)));              \
+    uint64_t tail_cache;                                                \
+    akq_wait_t not_empty __attribute__((aligned(AKQ_CACHELINE)));       \
+    akq_wait_t not_full;                                                \
+    __AKQ_STATS_FIELDS                                                  \
+  } __attribute__((aligned(AKQ_CACHELINE))) akq_##name##_t;
+
+#define __AKQ_RING_IMPL(name, SCOPE, akqval_t, maxsize)                 \
+  SCOPE akq_##name##_t *akq_##name##_create()                           \
+  {                                                                     \
+    akq_##name##_t *q;                                                  \
+    void *mem;                                                          \
+    uint64_t size = __akq_pow2(maxsize);                                \
+    if (posix_memalign(&mem, AKQ_CACHELINE, sizeof(akq_##name##_t)) != 0) { \
+      return NULL;                                                      \
+    }                                                                   \
+    q = mem;                                                            \
+    memset(q, 0, sizeof(akq_##name##_t));                               \
+    __akq_wait_init(&q->not_empty);                                     \
+    __akq_wait_init(&q->not_full);                                      \
+    __akq_wait_set(&q->not_empty, AKQ_WAIT_SPINS, AKQ_RING_WAIT_YIELDS); \
+    __akq_wait_set(&q->not_full, AKQ_WAIT_SPINS, AKQ_RING_WAIT_YIELDS); \
+    if (posix_memalign(&mem, AKQ_CACHELINE,                             \
+                       size * sizeof(akq_##name##_slot_t)) != 0) {      \
+      akq_##name##_destroy(q);                                          \
+      return NULL;                                                      \
+    }                                                                   \
+    q->slots = mem;                                                     \
+    q->mask = size - 1;                                                 \
+    return q;                                                           \
+  }                                                                     \
+  SCOPE void akq_##name##_destroy(akq_##name##_t *q)                    \
+  {                                                                     \
+    if (q == NULL) { return; }                                          \
+    free(q->slots);                                                     \
+    __akq_wait_destroy(&q->not_empty);                                  \
+    __akq_wait_destroy(&q->not_full);                                   \
+    free(q);                                                            \
+    /* user is responsible for freeing all values if needed */          \
+  }                                                                     \
+  SCOPE int akq_##name##_push(akq_##name##_t *q, akqval_t val)          \
+  {                                                                     \
+    uint64_t tail = q->tail;                                            \
+    if (tail - q->head_cache > q->mask) { /* looks full, re-check */    \
+      __AKQ_STATS_START(t0)                                             \
+      __akq_wait_until(&q->not_full,                                    \
+                       tail - (q->head_cache =                          \
+                               __atomic_load_n(&q->head, __ATOMIC_ACQUIRE)) \
+                       <= q->mask);                                     \
+      __akq_stats_waited(q, full, t0);                                  \
+    }                                                                   \
+    q->slots[tail & q->mask].value = val;                               \
+    __akq_stats_stamp(&q->slots[tail & q->mask], tail);                 \
+    __akq_stats_pushed(q, 1, tail + 1 - __atomic_load_n(&q->head, __ATOMIC_RELAXED)); \
+    __atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);             \
+    __akq_wake(&q->not_empty);                                          \
+    return 0;                                                           \
+  }                                                                     \
+  SCOPE akqval_t akq_##name##_shift(akq_##name##_t *q)                  \
+  {                                                                     \
+    akqval_t val;                                                       \
+    uint64_t head = q->head;                                            \
+    if (head == q->tail_cache) { /* looks empty, re-check */            \
+      __AKQ_STATS_START(t0)                                             \
+      __akq_wait_until(&q->not_empty,                                   \
+                       (q->tail_cache =                                 \
+                        __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE)) != head); \
+      __akq_stats_waited(q, empty, t0);                                 \
+    }                                                                   \
+    val = q->slots[head & q->mask].value;                               \
+    __akq_stats_latency(q, &q->slots[head & q->mask]);                  \
+    __akq_stats_shifted(q, 1);                                          \
+    __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);             \
+    __akq_wake(&q->not_full);                                           \
+    return val;                                                         \
+  }                                                                     \
+  SCOPE int __akq_##name##_can_push(akq_##name##_t *q)                  \
+  {                                                                     \
+    return q->tail - __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) <= q->mask; \
+  }                                                                     \
+  SCOPE int __akq_##name##_can_shift(akq_##name##_t *q)                 \
+  {                                                                     \
+    return __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) != q->head;      \
+  }                                                                     \
+  SCOPE uint32_t akq_##name##_try_push_n(akq_##name##_t *q,             \
+                                         const akqval_t *vals, uint32_t n) \
+  {                                                                     \
+    uint64_t tail = q->tail, space;                                     \
+    uint32_t i;                                                         \
+    space = q->mask + 1 - (tail - q->head_cache);                       \
+    if (space < n) {                                                    \
+      q->head_cache = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);      \
+      space = q->mask + 1 - (tail - q->head_cache);                     \
+      if (space < n) { n = (uint32_t)space; }                           \
+    }                                                                   \
+    if (n == 0) { return 0; }                                           \
+    __akq_stats_pushed(q, n, tail + n - __atomic_load_n(&q->head, __ATOMIC_RELAXED)); \
+    for (i = 0; i < n; i++) {                                           \
+      q->slots[(tail + i) & q->mask].value = vals[i];                   \
+      __akq_stats_stamp(&q->slots[(tail + i) & q->mask], tail + i);     \
+    }                                                                   \
+    /* publish the whole batch at once */                               \
+    __atomic_store_n(&q->tail, tail + n, __ATOMIC_RELEASE);             \
+    __akq_wake(&q->not_empty);                                          \
+    return n;                                                           \
+  }                                                                     \
+  SCOPE uint32_t akq_##name##_try_shift_n(akq_##name##_t *q,            \
+                                          akqval_t *vals, uint32_t n)   \
+  {                                                                     \
+    uint64_t head = q->head, avail;                                     \
+    uint32_t i;                                                         \
+    avail = q->tail_cache - head;                                       \
+    if (avail < n) {                                                    \
+      q->tail_cache = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);      \
+      avail = q->tail_cache - head;                                     \
+      if (avail < n) { n = (uint32_t)avail; }                           \
+    }                                                                   \
+    if (n == 0) { return 0; }                                           \
+    for (i = 0; i < n; i++) {                                           \
+      vals[i] = q->slots[(head + i) & q->mask].value;                   \
+      __akq_stats_latency(q, &q->slots[(head + i) & q->mask]);          \
+    }                                                                   \
+    __akq_stats_shifted(q, n);                                          \
+    __atomic_store_n(&q->head, head + n, __ATOMIC_RELEASE);             \
+    __akq_wake(&q->not_full);                                           \
+    return n;                                                           \
+  }                                                                     \
+  __AKQ_BATCH_IMPL(name, SCOPE, akqval_t, 1)                            \
+  __AKQ_STATS_IMPL(name, SCOPE)                                         \
+  SCOPE uint32_t akq_##name##_count(akq_##name##_t *q)                  \
+  {                                                                     \
+    uint64_t head = __atomic_load_n(&q->head, __ATOMIC_RELAXED);        \
+    uint64_t tail = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);        \
+    return tail > head ? (uint32_t)(tail - head) : 0;                   \
+  }                                                                     \
+  SCOPE void akq_##name##_set_wait(akq_##name##_t *q, uint32_t spins,   \
+                                   uint32_t yields)                     \
+  {                                                                     \
+    __akq_wait_set(&q->not_empty, spins, yields);                       \
+    __akq_wait_set(&q->not_full, spins, yields);                        \
+  }
+
+#define __AKQ_RING_INIT(name, SCOPE, akqval_t, maxsize) \
+  __AKQ_RING_TYPES(name, akqval_t)                      \
+  __AKQ_MPMC_PROTOTYPES(name, SCOPE, akqval_t)          \
+  __AKQ_RING_IMPL(name, SCOPE, akqval_t, maxsize)
+
+#define __AKQ_BCAST_TYPES(name, akqval_t)                               \
+  typedef struct {                                                      \
+    akqval_t value;                                                     \
+    __AKQ_STATS_STAMP                                                   \
+  } akq_##name##_slot_t;                                                \
+  typedef struct {                                                      \
+    /* next slot to shift from, written by this consumer only */        \
+    uint64_t head;                                                      \
+    uint64_t tail_cache;                                                \
+  } __attribute__((aligned(AKQ_CACHELINE))) akq_##name##_cursor_t;      \
+  typedef struct {                                                      \
+    akq_##name##_slot_t *slots;                                         \
+    uint64_t mask;                                                      \
+    akq_##name##_cursor_t *cursors;                                     \
+    uint32_t n_consumers;                                               \
+    /* written by the producer only */                                  \
+    uint64_t tail __attribute__((aligned(AKQ_CACHELINE)));              \
+    /* smallest consumer head seen by the producer */                   \
+    uint64_t head_cache;                                                \
+    akq_wait_t not_empty __attribute__((aligned(AKQ_CACHELINE)));       \
+    akq_wait_t not_full;                                                \
+    __AKQ_STATS_FIELDS                                                  \
+  } __attribute__((aligned(AKQ_CACHELINE))) akq_##name##_t;
+
+#define __AKQ_BCAST_PROTOTYPES(name, SCOPE, akqval_t)                   \
+  SCOPE akq_##name##_t *akq_##name##_create(uint32_t n_consumers);      \
+  SCOPE void akq_##name##_destroy(akq_##name##_t *q);                   \
+  SCOPE int akq_##name##_push(akq_##name##_t *q, akqval_t val);         \
+  SCOPE akqval_t akq_##name##_shift(akq_##name##_t *q, uint32_t c);     \
+  SCOPE uint32_t akq_##name##_count(akq_##name##_t *q);                 \
+  SCOPE uint32_t akq_##name##_consumer_count(akq_##name##_t *q, uint32_t c); \
+  SCOPE void akq_##name##_set_wait(akq_##name##_t *q, uint32_t spins,   \
+                                   uint32_t yields);                    \
+  SCOPE int akq_##name##_try_push(akq_##name##_t *q, akqval_t val);     \
+  SCOPE int akq_##name##_try_shift(akq_##name##_t *q, uint32_t c,       \
+                                   akqval_t *val);                      \
+  SCOPE int akq_##name##_push_n(akq_##name##_t *q, const akqval_t *vals, \
+                                uint32_t n);                            \
+  SCOPE uint32_t akq_##name##_shift_n(akq_##name##_t *q, uint32_t c,    \
+                                      akqval_t *vals, uint32_t n);      \
+  SCOPE uint32_t akq_##name##_try_push_n(akq_##name##_t *q,             \
+                                         const akqval_t *vals, uint32_t n); \
+  SCOPE uint32_t akq_##name##_try_shift_n(akq_##name##_t *q, uint32_t c, \
+                                          akqval_t *vals, uint32_t n);  \
+  SCOPE void akq_##name##_stats(akq_##name##_t *q, akq_stats_t *st);
+
+#define __AKQ_BCAST_IMPL(name, SCOPE, akqval_t, maxsize)                \
+  SCOPE akq_##name##_t *akq_##name##_create(uint32_t n_consumers)       \
+  {                                                                     \
+    akq_##name##_t *q;                                                  \
+    void *mem;                                                          \
+    uint64_t size = __akq_pow2(maxsize);                                \
+    if (n_consumers == 0) { return NULL; }                              \
+    if (posix_memalign(&mem, AKQ_CACHELINE, sizeof(akq_##name##_t)) != 0) { \
+      return NULL;                                                      \
+    }                                                                   \
+    q = mem;                                                            \
+    memset(q, 0, sizeof(akq_##name##_t));                               \
+    __akq_wait_init(&q->not_empty);                                     \
+    __akq_wait_init(&q->not_full);                                      \
+    if (posix_memalign(&mem, AKQ_CACHELINE,                             \
+                       size * sizeof(akq_##name##_slot_t)) != 0) {      \
+      akq_##name##_destroy(q);                                          \
+      return NULL;                                                      \
+    }                                                                   \
+    q->slots = mem;                                                     \
+    q->mask = size - 1;                                                 \
+    if (posix_memalign(&mem, AKQ_CACHELINE,                             \
+                       n_consumers * sizeof(akq_##name##_cursor_t)) != 0) { \
+      akq_##name##_destroy(q);                                          \
+      return NULL;                                                      \
+    }                                                                   \
+    q->cursors = mem;                                                   \
+    memset(q->cursors, 0, n_consumers * sizeof(akq_##name##_cursor_t)); \
+    q->n_consumers = n_consumers;                                       \
+    return q;                                                           \
+  }                                                                     \
+  SCOPE void akq_##name##_destroy(akq_##name##_t *q)                    \
+  {                                                                     \
+    if (q == NULL) { return; }                                          \
+    free(q->slots);                                                     \
+    free(q->cursors);                                                   \
+    __akq_wait_destroy(&q->not_empty);                                  \
+    __akq_wait_destroy(&q->not_full);                                   \
+    free(q);                                                            \
+    /* user is responsible for freeing all values if needed */          \
+  }                                                                     \
+  /* the head of the slowest consumer */                                \
+  SCOPE uint64_t __akq_##name##_min_head(akq_##name##_t *q)             \
+  {                                                                     \
+    uint64_t head, min = __atomic_load_n(&q->cursors[0].head, __ATOMIC_ACQUIRE); \
+    uint32_t c;                                                         \
+    for (c = 1; c < q->n_consumers; c++) {                              \
+      head = __atomic_load_n(&q->cursors[c].head, __ATOMIC_ACQUIRE);    \
+      if (head < min) { min = head; }                                   \
+    }                                                                   \
+    return min;                                                         \
+  }                                                                     \
+  SCOPE int akq_##name##_push(akq_##name##_t *q, akqval_t val)          \
+  {                                                                     \
+    uint64_t tail = q->tail;                                            \
+    if (tail - q->head_cache > q->mask) { /* looks full, re-check */    \
+      __AKQ_STATS_START(t0)                                             \
+      __akq_wait_until(&q->not_full,                                    \
+                       tail - (q->head_cache = __akq_##name##_min_head(q)) \
+                       <= q->mask);                                     \
+      __akq_stats_waited(q, full, t0);                                  \
+    }                                                                   \
+    q->slots[tail & q->mask].value = val;                               \
+    __akq_stats_stamp(&q->slots[tail & q->mask], tail);                 \
+    __akq_stats_pushed(q, 1, tail + 1 - q->head_cache);                 \
+    __atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);             \
+    __akq_wake(&q->not_empty);                                          \
+    return 0;                                                           \
+  }                                                                     \
+  SCOPE int __akq_##name##_can_push(akq_##name##_t *q)                  \
+  {                                                                     \
+    return q->tail - __akq_##name##_min_head(q) <= q->mask;             \
+  }                                                                     \
+  SCOPE uint32_t akq_##name##_try_push_n(akq_##name##_t *q,             \
+                                         const akqval_t *vals, uint32_t n) \
+  {                                                                     \
+    uint64_t tail = q->tail, space;                                     \
+    uint32_t i;                                                         \
+    space = q->mask + 1 - (tail - q->head_cache);                       \
+    if (space < n) {                                                    \
+      q->head_cache = __akq_##name##_min_head(q);                       \
+      space = q->mask + 1 - (tail - q->head_cache);                     \
+      if (space < n) { n = (uint32_t)space; }                           \
+    }                                                                   \
+    if (n == 0) { return 0; }                                           \
+    __akq_stats_pushed(q, n, tail + n - q->head_cache);                 \
+    for (i = 0; i < n; i++) {                                           \
+      q->slots[(tail + i) & q->mask].value = vals[i];                   \
+      __akq_stats_stamp(&q->slots[(tail + i) & q->mask], tail + i);     \
+    }                                                                   \
+    __atomic_store_n(&q->tail, tail + n, __ATOMIC_RELEASE);             \
+    __akq_wake(&q->not_empty);                                          \
+    return n;                                                           \
+  }                                                                     \
+  __AKQ_BATCH_PUSH_IMPL(name, SCOPE, akqval_t, 1)                       \
+  SCOPE akqval_t akq_##name##_shift(akq_##name##_t *q, uint32_t c)      \
+  {                                                                     \
+    akq_##name##_cursor_t *cur = &q->cursors[c];                        \
+    akqval_t val;                                                       \
+    uint64_t head = cur->head;                                          \
+    if (head == cur->tail_cache) { /* looks empty, re-check */          \
+      __AKQ_STATS_START(t0)                                             \
+      __akq_wait_until(&q->not_empty,                                   \
+                       (cur->tail_cache =                               \
+                        __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE)) != head); \
+      __akq_stats_waited(q, empty, t0);                                 \
+    }                                                                   \
+    val = q->slots[head & q->mask].value;                               \
+    __akq_stats_latency(q, &q->slots[head & q->mask]);                  \
+    __akq_stats_shifted(q, 1);                                          \
+    __atomic_store_n(&cur->head, head + 1, __ATOMIC_RELEASE);           \
+    __akq_wake(&q->not_full);                                           \
+    return val;                                                         \
+  }                                                                     \
+  SCOPE uint32_t akq_##name##_try_shift_n(akq_##name##_t *q, uint32_t c, \
+                                          akqval_t *vals, uint32_t n)   \
+  {                                                                     \
+    akq_##name##_cursor_t *cur = &q->cursors[c];                        \
+    uint64_t head = cur->head, avail;                                   \
+    uint32_t i;                                                         \
+    avail = cur->tail_cache - head;                                     \
+    if (avail < n) {                                                    \
+      cur->tail_cache = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);    \
+      avail = cur->tail_cache - head;                                   \
+      if (avail < n) { n = (uint32_t)avail; }                           \
+    }                                                                   \
+    if (n == 0) { return 0; }                                           \
+    for (i = 0; i < n; i++) {                                           \
+      vals[i] = q->slots[(head + i) & q->mask].value;                   \
+      __akq_stats_latency(q, &q->slots[(head + i) & q->mask]);          \
+    }                                                                   \
+    __akq_stats_shifted(q, n);                                          \
+    __atomic_store_n(&cur->head, head + n, __ATOMIC_RELEASE);           \
+    __akq_wake(&q->not_full);                                           \
+    return n;                                                           \
+  }                                                                     \
+  SCOPE int akq_##name##_try_shift(akq_##name##_t *q, uint32_t c,       \
+                                   akqval_t *val)                       \
+  {                                                                     \
+    return akq_##name##_try_shift_n(q, c, val, 1) == 1 ? 0 : -1;        \
+  }                                                                     \
+  SCOPE uint32_t akq_##name##_shift_n(akq_##name##_t *q, uint32_t c,    \
+                                      akqval_t *vals, uint32_t n)       \
+  {                                                                     \
+    uint32_t k;                                                         \
+    if (n == 0) { return 0; }                                           \
+    while ((k = akq_##name##_try_shift_n(q, c, vals, n)) == 0) {        \
+      __AKQ_STATS_START(t0)                                             \
+      __akq_wait_until(&q->not_empty,                                   \
+                       __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) !=   \
+                       q->cursors[c].head);                             \
+      __akq_stats_waited(q, empty, t0);                                 \
+    }                                                                   \
+    return k;                                                           \
+  }                                                                     \
+  __AKQ_STATS_IMPL(name, SCOPE)                                         \
+  SCOPE uint32_t akq_##name##_count(akq_##name##_t *q)                  \
+  {                                                                     \
+    uint64_t head = __akq_##name##_min_head(q);                         \
+    uint64_t tail = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);        \
+    return tail > head ? (uint32_t)(tail - head) : 0;                   \
+  }                                                                     \
+  SCOPE uint32_t akq_##name##_consumer_count(akq_##name##_t *q, uint32_t c) \
+  {                                                                     \
+    uint64_t head = __atomic_load_n(&q->cursors[c].head, __ATOMIC_RELAXED); \
+    uint64_t tail = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);        \
+    return tail > head ? (uint32_t)(tail - head) : 0;                   \
+  }                                                                     \
+  SCOPE void akq_##name##_set_wait(akq_##name##_t *q, uint32_t spins,   \
+                                   uint32_t yields)                     \
+  {                                                                     \
+    __akq_wait_set(&q->not_empty, spins, yields);                       \
+    __akq_wait_set(&q->not_full, spins, yields);                        \
+  }
+
+#define __AKQ_BCAST_INIT(name, SCOPE, akqval_t, maxsize) \
+  __AKQ_BCAST_TYPES(name, akqval_t)                      \
+  __AKQ_BCAST_PROTOTYPES(name, SCOPE, akqval_t)          \
+  __AKQ_BCAST_IMPL(name, SCOPE, akqval_t, maxsize)
+
+/** Instantiate a bounded single-producer, single-consumer ring
+ *
+ * @param name          Name of the queue [symbol]
+ * @param akqval_t      Type of values
+ * @param maxsize       Capacity of the queue, rounded up to a power of two
+ *
+ * At most one thread may push and one (other) thread shift at any time.
+ * akq_push waits while the queue is full, and akq_shift while it is empty.
+ * akq_size is not available, use akq_count instead.
+ *
+ * Unlike the other variants, a waiting thread spins and yields but never
+ * sleeps (unless AKQ_RING_WAIT_YIELDS is defined or akq_set_wait is called
+ * with a number of yields), which keeps pushes and shifts free of memory
+ * fences. Enable sleeping if a side may stay idle for long.
+ */
+#define AKQ_RING_INIT(name, akqval_t, maxsize)                  \
+  __AKQ_RING_INIT(name, UNUSED static inline, akqval_t, maxsize)
+
+/** Instantiate a bounded multi-producer, multi-consumer queue
+ *
+ * @param name          Name of the queue [symbol]
+ * @param akqval_t      Type of values
+ * @param maxsize       Capacity of the queue, rounded up to a power of two
+ *
+ * Any number of threads may push and shift concurrently. akq_push waits while
+ * the queue is full, and akq_shift while it is empty. akq_size is not
+ * available, use akq_count instead.
+ */
+#define AKQ_MPMC_INIT(name, akqval_t, maxsize)                  \
+  __AKQ_MPMC_INIT(name, UNUSED static inline, akqval_t, maxsize)
+
+/** Instantiate a bounded single-producer, multi-consumer broadcast ring
+ *
+ * @param name          Name of the queue [symbol]
+ * @param akqval_t      Type of values
+ * @param maxsize       Capacity of the queue, rounded up to a power of two
+ *
+ * Every value pushed is seen by every consumer: each consumer has its own
+ * cursor over the one shared buffer, and akq_push waits only while the
+ * slowest consumer is maxsize values behind. Consumers get copies of the
+ * values, so a pointer pushed once is shared by all of them (and the user
+ * must decide when it may be freed).
+ *
+ * Create the queue with akq_bcast_create, giving the number of consumers.
+ * At most one thread may push, and each consumer index must be used by a
+ * single thread, with akq_bcast_shift and friends. akq_count gives the number
+ * of values the slowest consumer has yet to shift.
+ *
+ * With AKQ_STATS, consumer statistics are summed over all consumers: shifts
+ * counts every consumer's shifts (n_consumers times pushes once all have
+ * caught up), empty waits are those of any consumer, and the latency
+ * histogram mixes the delays seen by every consumer.
+ */
+#define AKQ_BCAST_INIT(name, akqval_t, maxsize)                 \
+  __AKQ_BCAST_INIT(name, UNUSED static inline, akqval_t, maxsize)
+
 /** Convenience macros */
 
 /** Type of the queue
@@ -237,6 +1341,15 @@ int main(int argc, char **argv)
  */
 #define akq_size(q) ((q)->size)
 
+/** Get the (approximate, if other threads are active) number of elements in
+ * the given queue. Works for all queue variants
+ *
+ * @param name          Name of the queue [symbol]
+ * @param q             Pointer to the queue to get size of [akq_t(name)*]
+ * @return number of elements in the queue
+ */
+#define akq_count(name, q) akq_##name##_count(q)
+
 /** Push a value to the tail of the queue
  *
  * @param name          Name of the queue [symbol]
@@ -254,6 +1367,166 @@ int main(int argc, char **argv)
  */
 #define akq_shift(name, q) akq_##name##_shift(q)
 
+/** Push a value to the tail of the queue, unless it is full
+ *
+ * @param name          Name of the queue [symbol]
+ * @param q             Pointer to the queue [akq_t(name)*]
+ * @param val           Value to add to the queue [akqval_t]
+ * @return 0 if the value was added, -1 if the queue was full
+ */
+#define akq_try_push(name, q, val) akq_##name##_try_push(q, val)
+
+/** Shift a value from the head of the queue, unless it is empty
+ *
+ * @param name          Name of the queue [symbol]
+ * @param q             Pointer to the queue [akq_t(name)*]
+ * @param val           Pointer to the shifted value [akqval_t*]
+ * @return 0 if a value was shifted, -1 if the queue was empty
+ */
+#define akq_try_shift(name, q, val) akq_##name##_try_shift(q, val)
+
+/** Push an array of values to the tail of the queue, waiting for space as
+ * needed
+ *
+ * @param name          Name of the queue [symbol]
+ * @param q             Pointer to the queue [akq_t(name)*]
+ * @param vals          Values to add to the queue [const akqval_t*]
+ * @param n             Number of values [uint32_t]
+ * @return 0 once all values were added, -1 if a value could not be added
+ * even though the queue had room for it (e.g., the list-based queue failed to
+ * allocate a node), in which case some of the values may have been added
+ *
+ * Values are made visible to consumers in as few batches as free space
+ * allows; other producers (of an MPMC queue) may interleave between batches.
+ */
+#define akq_push_n(name, q, vals, n) akq_##name##_push_n(q, vals, n)
+
+/** Shift up to n values from the head of the queue, waiting until there is at
+ * least one
+ *
+ * @param name          Name of the queue [symbol]
+ * @param q             Pointer to the queue [akq_t(name)*]
+ * @param vals          Array to shift values into [akqval_t*]
+ * @param n             Maximum number of values to shift [uint32_t]
+ * @return number of values shifted (at least 1 unless n is 0)
+ */
+#define akq_shift_n(name, q, vals, n) akq_##name##_shift_n(q, vals, n)
+
+/** Push as many values from an array as currently fit in the queue
+ *
+ * @param name          Name of the queue [symbol]
+ * @param q             Pointer to the queue [akq_t(name)*]
+ * @param vals          Values to add to the queue [const akqval_t*]
+ * @param n             Number of values [uint32_t]
+ * @return number of values added, from the start of vals (may be 0)
+ */
+#define akq_try_push_n(name, q, vals, n) akq_##name##_try_push_n(q, vals, n)
+
+/** Shift as many values (up to n) as are currently in the queue
+ *
+ * @param name          Name of the queue [symbol]
+ * @param q             Pointer to the queue [akq_t(name)*]
+ * @param vals          Array to shift values into [akqval_t*]
+ * @param n             Maximum number of values to shift [uint32_t]
+ * @return number of values shifted (may be 0)
+ */
+#define akq_try_shift_n(name, q, vals, n) akq_##name##_try_shift_n(q, vals, n)
+
+/** Set how threads wait for data or space in the queue
+ *
+ * @param name          Name of the queue [symbol]
+ * @param q             Pointer to the queue [akq_t(name)*]
+ * @param spins         Number of busy-wait iterations before yielding
+ *                      (default AKQ_WAIT_SPINS) [uint32_t]
+ * @param yields        Number of sched_yield calls before sleeping (default
+ *                      AKQ_WAIT_YIELDS, or AKQ_RING_WAIT_YIELDS for
+ *                      AKQ_RING_INIT queues), or AKQ_NO_PARK to never sleep
+ *                      [uint32_t]
+ *
+ * Must be called while no thread is using the queue. Never sleeping saves
+ * pushes and shifts a memory fence, at the cost of a busy (yielding) CPU for
+ * each waiting thread.
+ */
+#define akq_set_wait(name, q, spins, yields)    \
+  akq_##name##_set_wait(q, spins, yields)
+
+/** Get statistics about the given queue
+ *
+ * @param name          Name of the queue [symbol]
+ * @param q             Pointer to the queue [akq_t(name)*]
+ * @param st            Statistics to fill [akq_stats_t*]
+ *
+ * All statistics are 0 unless AKQ_STATS is defined. They are read while other
+ * threads may be updating them, so they need not be consistent with each
+ * other (e.g., pushes - shifts may differ from akq_count).
+ */
+#define akq_stats(name, q, st) akq_##name##_stats(q, st)
+
+/** Create a new broadcast queue (see AKQ_BCAST_INIT)
+ *
+ * @param name          Name of the queue [symbol]
+ * @param n_consumers   Number of consumers, numbered from 0 [uint32_t]
+ * @return pointer to the created queue if successful, NULL otherwise
+ */
+#define akq_bcast_create(name, n_consumers) akq_##name##_create(n_consumers)
+
+/** Shift the next value for consumer c of a broadcast queue, waiting while
+ * there is none
+ *
+ * @param name          Name of the queue [symbol]
+ * @param q             Pointer to the queue [akq_t(name)*]
+ * @param c             Index of the consumer [uint32_t]
+ * @return value shifted from the queue [akqval_t]
+ */
+#define akq_bcast_shift(name, q, c) akq_##name##_shift(q, c)
+
+/** Shift the next value for consumer c of a broadcast queue, unless there is
+ * none
+ *
+ * @param name          Name of the queue [symbol]
+ * @param q             Pointer to the queue [akq_t(name)*]
+ * @param c             Index of the consumer [uint32_t]
+ * @param val           Pointer to the shifted value [akqval_t*]
+ * @return 0 if a value was shifted, -1 if there was none
+ */
+#define akq_bcast_try_shift(name, q, c, val) akq_##name##_try_shift(q, c, val)
+
+/** Shift up to n values for consumer c of a broadcast queue, waiting until
+ * there is at least one
+ *
+ * @param name          Name of the queue [symbol]
+ * @param q             Pointer to the queue [akq_t(name)*]
+ * @param c             Index of the consumer [uint32_t]
+ * @param vals          Array to shift values into [akqval_t*]
+ * @param n             Maximum number of values to shift [uint32_t]
+ * @return number of values shifted (at least 1 unless n is 0)
+ */
+#define akq_bcast_shift_n(name, q, c, vals, n)  \
+  akq_##name##_shift_n(q, c, vals, n)
+
+/** Shift as many values (up to n) as there currently are for consumer c of a
+ * broadcast queue
+ *
+ * @param name          Name of the queue [symbol]
+ * @param q             Pointer to the queue [akq_t(name)*]
+ * @param c             Index of the consumer [uint32_t]
+ * @param vals          Array to shift values into [akqval_t*]
+ * @param n             Maximum number of values to shift [uint32_t]
+ * @return number of values shifted (may be 0)
+ */
+#define akq_bcast_try_shift_n(name, q, c, vals, n)      \
+  akq_##name##_try_shift_n(q, c, vals, n)
+
+/** Get the (approximate) number of values consumer c of a broadcast queue has
+ * yet to shift
+ *
+ * @param name          Name of the queue [symbol]
+ * @param q             Pointer to the queue [akq_t(name)*]
+ * @param c             Index of the consumer [uint32_t]
+ * @return number of values waiting for the consumer
+ */
+#define akq_bcast_count(name, q, c) akq_##name##_consumer_count(q, c)
+
 #endif /* HAVE_PTHREAD */
 
 #endif /* __AKQ_H */
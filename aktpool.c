@@ -0,0 +1,440 @@
+/*
+ * Copyright (C) 2026 The Regents of the University of California.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "config.h"
+#ifdef HAVE_PTHREAD
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "akq.h"
+#include "aktpool.h"
+
+/** State shared by all the tasks of one aktp_parallel_for call */
+typedef struct range_job {
+  aktp_range_f *fn;
+  void *user;
+  uint64_t grain;
+  /** Number of indexes not yet processed */
+  uint64_t remaining;
+} range_job_t;
+
+/** A task: either fn(user), or the sub-range [begin, end) of job */
+typedef struct task {
+  aktp_task_f *fn;
+  void *user;
+  range_job_t *job;
+  uint64_t begin;
+  uint64_t end;
+} task_t;
+
+AKQ_MPMC_INIT(aktp_inject, task_t, AKTP_INJECT_SIZE)
+
+/** Chase-Lev work-stealing deque (with the memory orderings from Le et al.,
+ * "Correct and Efficient Work-Stealing for Weak Memory Models", PPoPP'13) */
+typedef struct deque {
+  /** Next task to steal, moved by thieves (and the owner for the last task) */
+  int64_t top __attribute__((aligned(AKQ_CACHELINE)));
+  /** Next free slot, moved by the owner only */
+  int64_t bottom __attribute__((aligned(AKQ_CACHELINE)));
+  task_t tasks[AKTP_DEQUE_SIZE];
+} deque_t;
+
+typedef struct worker {
+  deque_t dq;
+  aktp_t *pool;
+  pthread_t thread;
+  /** State of the xorshift generator used to pick victims */
+  uint32_t rand;
+} __attribute__((aligned(AKQ_CACHELINE))) worker_t;
+
+struct aktp {
+  worker_t *workers;
+  int n_threads;
+
+  /** Tasks submitted from outside the pool */
+  akq_t(aktp_inject) *inject;
+
+  /** Number of tasks submitted but not yet completed */
+  uint64_t pending;
+
+  int shutdown;
+
+  /** Workers waiting for tasks */
+  akq_wait_t idle;
+
+  /** Threads waiting for tasks to complete */
+  akq_wait_t done;
+};
+
+/** The worker run by the current thread, if any */
+static __thread worker_t *self = NULL;
+
+/* Tasks are copied field by field with relaxed atomics, since a thief may
+   read a slot while the owner is overwriting it (the thief's CAS on top then
+   fails and the copy is discarded) */
+static void task_store(task_t *dst, const task_t *src)
+{
+  __atomic_store_n(&dst->fn, src->fn, __ATOMIC_RELAXED);
+  __atomic_store_n(&dst->user, src->user, __ATOMIC_RELAXED);
+  __atomic_store_n(&dst->job, src->job, __ATOMIC_RELAXED);
+  __atomic_store_n(&dst->begin, src->begin, __ATOMIC_RELAXED);
+  __atomic_store_n(&dst->end, src->end, __ATOMIC_RELAXED);
+}
+
+static void task_load(task_t *dst, const task_t *src)
+{
+  dst->fn = __atomic_load_n(&src->fn, __ATOMIC_RELAXED);
+  dst->user = __atomic_load_n(&src->user, __ATOMIC_RELAXED);
+  dst->job = __atomic_load_n(&src->job, __ATOMIC_RELAXED);
+  dst->begin = __atomic_load_n(&src->begin, __ATOMIC_RELAXED);
+  dst->end = __atomic_load_n(&src->end, __ATOMIC_RELAXED);
+}
+
+static int deque_push(deque_t *dq, const task_t *t)
+{
+  int64_t b = __atomic_load_n(&dq->bottom, __ATOMIC_RELAXED);
+  int64_t top = __atomic_load_n(&dq->top, __ATOMIC_ACQUIRE);
+  if (b - top >= AKTP_DEQUE_SIZE) {
+    return -1;
+  }
+  task_store(&dq->tasks[b % AKTP_DEQUE_SIZE], t);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  __atomic_store_n(&dq->bottom, b + 1, __ATOMIC_RELAXED);
+  return 0;
+}
+
+static int deque_pop(deque_t *dq, task_t *t)
+{
+  int64_t b = __atomic_load_n(&dq->bottom, __ATOMIC_RELAXED) - 1;
+  int64_t top;
+  int ret = 0;
+  __atomic_store_n(&dq->bottom, b, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  top = __atomic_load_n(&dq->top, __ATOMIC_RELAXED);
+  if (top > b) {
+    /* empty */
+    __atomic_store_n(&dq->bottom, b + 1, __ATOMIC_RELAXED);
+    return -1;
+  }
+  task_load(t, &dq->tasks[b % AKTP_DEQUE_SIZE]);
+  if (top == b) {
+    /* last task, race thieves for it */
+    if (!__atomic_compare_exchange_n(&dq->top, &top, top + 1, 0,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+      ret = -1;
+    }
+    __atomic_store_n(&dq->bottom, b + 1, __ATOMIC_RELAXED);
+  }
+  return ret;
+}
+
+static int deque_steal(deque_t *dq, task_t *t)
+{
+  int64_t top = __atomic_load_n(&dq->top, __ATOMIC_ACQUIRE);
+  int64_t b;
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  b = __atomic_load_n(&dq->bottom, __ATOMIC_ACQUIRE);
+  if (top >= b) {
+    return -1;
+  }
+  task_load(t, &dq->tasks[top % AKTP_DEQUE_SIZE]);
+  if (!__atomic_compare_exchange_n(&dq->top, &top, top + 1, 0,
+                                   __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+    return -1; /* lost the race */
+  }
+  return 0;
+}
+
+static int deque_empty(deque_t *dq)
+{
+  return __atomic_load_n(&dq->bottom, __ATOMIC_RELAXED) <=
+    __atomic_load_n(&dq->top, __ATOMIC_RELAXED);
+}
+
+static int has_work(aktp_t *p)
+{
+  int i;
+  if (__atomic_load_n(&p->shutdown, __ATOMIC_ACQUIRE) ||
+      akq_count(aktp_inject, p->inject) != 0) {
+    return 1;
+  }
+  for (i = 0; i < p->n_threads; i++) {
+    if (!deque_empty(&p->workers[i].dq)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* Find a task: from our own deque, then from outside the pool, then steal one
+   from another worker */
+static int find_task(aktp_t *p, worker_t *w, task_t *t)
+{
+  int i, victim;
+  if (deque_pop(&w->dq, t) == 0 ||
+      akq_try_shift(aktp_inject, p->inject, t) == 0) {
+    return 0;
+  }
+  w->rand ^= w->rand << 13;
+  w->rand ^= w->rand >> 17;
+  w->rand ^= w->rand << 5;
+  victim = w->rand % p->n_threads;
+  for (i = 0; i < p->n_threads; i++) {
+    if (&p->workers[victim] != w &&
+        deque_steal(&p->workers[victim].dq, t) == 0) {
+      return 0;
+    }
+    if (++victim == p->n_threads) {
+      victim = 0;
+    }
+  }
+  return -1;
+}
+
+/* Make a task available to the pool. Fails only if w's deque is full */
+static int spawn(aktp_t *p, worker_t *w, const task_t *t)
+{
+  __atomic_add_fetch(&p->pending, 1, __ATOMIC_RELAXED);
+  if (w != NULL) {
+    if (deque_push(&w->dq, t) != 0) {
+      __atomic_sub_fetch(&p->pending, 1, __ATOMIC_RELAXED);
+      return -1;
+    }
+  } else {
+    akq_push(aktp_inject, p->inject, *t);
+  }
+  __akq_wake(&p->idle);
+  return 0;
+}
+
+static void run_range(aktp_t *p, worker_t *w, task_t *t)
+{
+  range_job_t *job = t->job;
+  uint64_t begin = t->begin, end = t->end;
+  task_t half;
+  /* keep the first half, offer the second to thieves */
+  while (end - begin > job->grain) {
+    half.fn = NULL;
+    half.user = NULL;
+    half.job = job;
+    half.begin = begin + (end - begin) / 2;
+    half.end = end;
+    if (spawn(p, w, &half) != 0) {
+      break; /* deque is full, do the rest here */
+    }
+    end = half.begin;
+  }
+  job->fn(begin, end, job->user);
+  if (__atomic_sub_fetch(&job->remaining, end - begin, __ATOMIC_ACQ_REL) == 0) {
+    __akq_wake(&p->done);
+  }
+}
+
+static void run_task(aktp_t *p, worker_t *w, task_t *t)
+{
+  if (t->job == NULL) {
+    t->fn(t->user);
+  } else {
+    run_range(p, w, t);
+  }
+  if (__atomic_sub_fetch(&p->pending, 1, __ATOMIC_ACQ_REL) == 0) {
+    __akq_wake(&p->done);
+  }
+}
+
+static void *worker_run(void *user)
+{
+  worker_t *w = user;
+  aktp_t *p = w->pool;
+  task_t t;
+
+  self = w;
+  for (;;) {
+    if (find_task(p, w, &t) == 0) {
+      run_task(p, w, &t);
+      continue;
+    }
+    if (__atomic_load_n(&p->shutdown, __ATOMIC_ACQUIRE)) {
+      break;
+    }
+    __akq_wait_until(&p->idle, has_work(p));
+  }
+  return NULL;
+}
+
+static worker_t *current_worker(aktp_t *p)
+{
+  return (self != NULL && self->pool == p) ? self : NULL;
+}
+
+static void stop_workers(aktp_t *p, int n_started)
+{
+  int i;
+  __atomic_store_n(&p->shutdown, 1, __ATOMIC_RELEASE);
+  __akq_wake(&p->idle);
+  for (i = 0; i < n_started; i++) {
+    pthread_join(p->workers[i].thread, NULL);
+  }
+}
+
+static void pool_free(aktp_t *p)
+{
+  akq_destroy(aktp_inject, p->inject);
+  __akq_wait_destroy(&p->idle);
+  __akq_wait_destroy(&p->done);
+  free(p->workers);
+  free(p);
+}
+
+/* ========== PUBLIC FUNCTIONS ========== */
+
+aktp_t *aktp_create(int n_threads)
+{
+  aktp_t *p;
+  void *mem;
+  int i;
+
+  if (n_threads <= 0 && (n_threads = sysconf(_SC_NPROCESSORS_ONLN)) <= 0) {
+    n_threads = 1;
+  }
+
+  if ((p = calloc(1, sizeof(aktp_t))) == NULL) {
+    return NULL;
+  }
+  __akq_wait_init(&p->idle);
+  __akq_wait_init(&p->done);
+  if (posix_memalign(&mem, AKQ_CACHELINE, sizeof(worker_t) * n_threads) != 0) {
+    mem = NULL;
+  }
+  p->workers = mem;
+  if (p->workers == NULL ||
+      (p->inject = akq_create(aktp_inject)) == NULL) {
+    pool_free(p);
+    return NULL;
+  }
+  memset(p->workers, 0, sizeof(worker_t) * n_threads);
+  p->n_threads = n_threads;
+
+  for (i = 0; i < n_threads; i++) {
+    p->workers[i].pool = p;
+    p->workers[i].rand = 2463534242U + i;
+    if (pthread_create(&p->workers[i].thread, NULL, worker_run,
+                       &p->workers[i]) != 0) {
+      stop_workers(p, i);
+      pool_free(p);
+      return NULL;
+    }
+  }
+
+  return p;
+}
+
+void aktp_destroy(aktp_t *p)
+{
+  if (p == NULL) {
+    return;
+  }
+  aktp_wait(p);
+  stop_workers(p, p->n_threads);
+  pool_free(p);
+}
+
+int aktp_n_threads(aktp_t *p)
+{
+  return p->n_threads;
+}
+
+void aktp_submit(aktp_t *p, aktp_task_f *fn, void *user)
+{
+  task_t t;
+  t.fn = fn;
+  t.user = user;
+  t.job = NULL;
+  t.begin = t.end = 0;
+  if (spawn(p, current_worker(p), &t) != 0) {
+    fn(user); /* our deque is full, run it now */
+  }
+}
+
+void aktp_wait(aktp_t *p)
+{
+  __akq_wait_until(&p->done, __atomic_load_n(&p->pending, __ATOMIC_ACQUIRE) == 0);
+}
+
+void aktp_parallel_for(aktp_t *p, uint64_t begin, uint64_t end,
+                       uint64_t grain, aktp_range_f *fn, void *user)
+{
+  worker_t *w = current_worker(p);
+  range_job_t job;
+  task_t t;
+
+  if (end <= begin) {
+    return;
+  }
+  if (grain == 0) {
+    /* a few pieces per thread, so that stealing can even out the load */
+    grain = (end - begin) / (8 * (uint64_t)p->n_threads);
+    if (grain == 0) {
+      grain = 1;
+    }
+  }
+
+  job.fn = fn;
+  job.user = user;
+  job.grain = grain;
+  job.remaining = end - begin;
+
+  t.fn = NULL;
+  t.user = NULL;
+  t.job = &job;
+  t.begin = begin;
+  t.end = end;
+
+  if (w != NULL) {
+    /* run the range here, and help with other tasks until it is done */
+    __atomic_add_fetch(&p->pending, 1, __ATOMIC_RELAXED);
+    run_task(p, w, &t);
+    while (__atomic_load_n(&job.remaining, __ATOMIC_ACQUIRE) != 0) {
+      if (find_task(p, w, &t) == 0) {
+        run_task(p, w, &t);
+      } else {
+        sched_yield();
+      }
+    }
+  } else {
+    /* never fails: waits for room in the injection queue */
+    spawn(p, NULL, &t);
+    __akq_wait_until(&p->done,
+                     __atomic_load_n(&job.remaining, __ATOMIC_ACQUIRE) == 0);
+  }
+}
+
+#endif /* HAVE_PTHREAD */
@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2026 The Regents of the University of California.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __AKTPOOL_H
+#define __AKTPOOL_H
+
+#include "config.h"
+#ifdef HAVE_PTHREAD
+
+#include <stdint.h>
+
+/** @file
+ *
+ * @brief A fixed-size pool of worker threads with work stealing.
+ *
+ * Each worker owns a Chase-Lev deque: it pushes and pops tasks at the bottom,
+ * while idle workers steal from the top, so work spreads to where there are
+ * free cores without any central lock. Tasks submitted from outside the pool
+ * go through a shared MPMC queue (akq.h). Workers with nothing to do spin
+ * briefly and then sleep until new work is submitted.
+ *
+ * aktp_parallel_for splits a range in halves, keeping one half and making
+ * the other available to thieves, until pieces are at most grain elements,
+ * which gives good load balance even when iterations have uneven cost.
+ *
+ */
+
+/*
+  Example usage.
+
+#include "aktpool.h"
+
+static void sum_range(uint64_t begin, uint64_t end, void *user)
+{
+  uint64_t *sum = user, i, s = 0;
+  for (i = begin; i < end; i++) {
+    s += i;
+  }
+  __sync_fetch_and_add(sum, s);
+}
+
+int main(int argc, char **argv)
+{
+  uint64_t sum = 0;
+  aktp_t *p = aktp_create(0);
+  aktp_parallel_for(p, 0, 1000000, 1000, sum_range, &sum);
+  aktp_destroy(p);
+  return 0;
+}
+*/
+
+/** Capacity of each worker's deque. A task spawned by a worker whose deque is
+ * full is run immediately instead */
+#ifndef AKTP_DEQUE_SIZE
+#define AKTP_DEQUE_SIZE 4096
+#endif
+
+/** Capacity of the queue of tasks submitted from outside the pool */
+#ifndef AKTP_INJECT_SIZE
+#define AKTP_INJECT_SIZE 4096
+#endif
+
+/** Opaque structure for a thread pool */
+typedef struct aktp aktp_t;
+
+/** Signature of a task function
+ *
+ * @param user          User pointer passed to aktp_submit
+ */
+typedef void (aktp_task_f)(void *user);
+
+/** Signature of a range function for aktp_parallel_for
+ *
+ * @param begin         First index of the sub-range
+ * @param end           One past the last index of the sub-range
+ * @param user          User pointer passed to aktp_parallel_for
+ */
+typedef void (aktp_range_f)(uint64_t begin, uint64_t end, void *user);
+
+/** Create a thread pool and start its workers
+ *
+ * @param n_threads     Number of worker threads, or 0 for one per online CPU
+ * @return pointer to the pool if successful, NULL otherwise
+ */
+aktp_t *aktp_create(int n_threads);
+
+/** Wait for all submitted tasks to complete, then stop the workers and free
+ * the pool
+ *
+ * @param p             Pointer to the pool to destroy
+ */
+void aktp_destroy(aktp_t *p);
+
+/** Get the number of worker threads in the pool
+ *
+ * @param p             Pointer to the pool
+ * @return number of worker threads
+ */
+int aktp_n_threads(aktp_t *p);
+
+/** Submit a task to the pool
+ *
+ * @param p             Pointer to the pool
+ * @param fn            Function to run
+ * @param user          User pointer to pass to fn
+ *
+ * May be called from any thread, including from within a task, in which case
+ * the new task is pushed onto the calling worker's own deque, or run right
+ * away if that deque is full. Waits if the queue of externally submitted tasks
+ * is full.
+ */
+void aktp_submit(aktp_t *p, aktp_task_f *fn, void *user);
+
+/** Wait until all tasks submitted so far (and any they spawned) complete
+ *
+ * @param p             Pointer to the pool
+ *
+ * Must not be called from within a task.
+ */
+void aktp_wait(aktp_t *p);
+
+/** Run fn over [begin, end) in parallel, in sub-ranges of at most grain
+ * indexes, and wait for it to complete
+ *
+ * @param p             Pointer to the pool
+ * @param begin         First index of the range
+ * @param end           One past the last index of the range
+ * @param grain         Maximum size of a sub-range (0 picks one based on the
+ *                      number of threads)
+ * @param fn            Function to run on each sub-range
+ * @param user          User pointer to pass to fn
+ *
+ * May be called from within a task, in which case the calling worker runs
+ * other tasks while it waits.
+ */
+void aktp_parallel_for(aktp_t *p, uint64_t begin, uint64_t end,
+                       uint64_t grain, aktp_range_f *fn, void *user);
+
+#endif /* HAVE_PTHREAD */
+
+#endif /* __AKTPOOL_H */
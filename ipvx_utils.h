@@ -38,6 +38,8 @@
 #include <netinet/in.h>
 #include <string.h>
 
+#include "khash.h"
+
 /// Represents an IPv4 or IPv6 prefix or address
 typedef struct ipvx_prefix {
   /// Address family (AF_INET or AF_INET6)
@@ -206,6 +208,125 @@ static inline int ipvx_addr_eq(const ipvx_prefix_t *a, const ipvx_prefix_t *b)
   return (memcmp(&a->addr, &b->addr, ipvx_family_size(a->family)) == 0);
 }
 
+/// Mask that is all ones for IPv6 and all zeros for IPv4, used to ignore the
+/// unused address words of IPv4 addresses without branching
+#define ipvx_v6_mask(family) (-(uint32_t)((family) == AF_INET6))
+
+/**
+ * Hash an IPv4 or IPv6 address
+ *
+ * @param a      Pointer to the address to hash
+ * @param extra  Additional value to mix into the hash
+ * @return a 64-bit hash of the address
+ *
+ * Only the bytes that are significant for the address family are hashed, so
+ * whatever is stored in the unused part of an IPv4 address is ignored. The
+ * address words are mixed with khash's 128-bit hash (kh_u128_hash64).
+ */
+static inline uint64_t ipvx_hash(const ipvx_prefix_t *a, uint64_t extra)
+{
+  const uint32_t m = ipvx_v6_mask(a->family);
+  const uint64_t lo = ((uint64_t)a->addr._u32[0] << 32) | (a->addr._u32[1] & m);
+  const uint64_t hi = ((uint64_t)(a->addr._u32[2] & m) << 32) |
+    (a->addr._u32[3] & m);
+  return kh_u128_hash64(hi, lo, (extra << 8) ^ a->family);
+}
+
+/**
+ * Hash an address (ignoring the mask length)
+ *
+ * @param a      Pointer to the address to hash
+ * @return a 64-bit hash of the address
+ */
+static inline uint64_t ipvx_addr_hash(const ipvx_prefix_t *a)
+{
+  return ipvx_hash(a, 0);
+}
+
+/**
+ * Hash a prefix (including the mask length)
+ *
+ * @param pfx    Pointer to the prefix to hash
+ * @return a 64-bit hash of the prefix
+ *
+ * The prefix must be normalized (see ipvx_normalize()).
+ */
+static inline uint64_t ipvx_pfx_hash(const ipvx_prefix_t *pfx)
+{
+  return ipvx_hash(pfx, pfx->masklen + 1);
+}
+
+/**
+ * Test two addresses (of any family) for equality without branching
+ *
+ * @param a      Pointer to first address
+ * @param b      Pointer to second address
+ * @return 1 if the addresses are equal, 0 if they are not
+ *
+ * Unlike ipvx_addr_eq(), the families are compared too.
+ */
+static inline int ipvx_addr_hash_equal(const ipvx_prefix_t *a,
+                                       const ipvx_prefix_t *b)
+{
+  const uint32_t m = ipvx_v6_mask(a->family);
+  return ((uint32_t)(a->family ^ b->family) |
+          (a->addr._u32[0] ^ b->addr._u32[0]) |
+          ((a->addr._u32[1] ^ b->addr._u32[1]) & m) |
+          ((a->addr._u32[2] ^ b->addr._u32[2]) & m) |
+          ((a->addr._u32[3] ^ b->addr._u32[3]) & m)) == 0;
+}
+
+/**
+ * Test two (normalized) prefixes of any family for equality without branching
+ *
+ * @param a      Pointer to first prefix
+ * @param b      Pointer to second prefix
+ * @return 1 if the prefixes are equal, 0 if they are not
+ */
+static inline int ipvx_pfx_hash_equal(const ipvx_prefix_t *a,
+                                      const ipvx_prefix_t *b)
+{
+  return ipvx_addr_hash_equal(a, b) & (a->masklen == b->masklen);
+}
+
+/*
+ * khash key support, e.g.:
+ *
+ *   #include "ipvx_utils.h"
+ *   KHASH_MAP_INIT_IPVX(addr2asn, uint32_t)
+ *
+ * Keys are stored by value. IPv4 and IPv6 keys may be mixed in one table.
+ */
+
+/// khash hash function for ipvx_prefix_t address keys
+#define kh_ipvx_addr_hash_func(key) ipvx_addr_hash(&(key))
+/// khash equality function for ipvx_prefix_t address keys
+#define kh_ipvx_addr_hash_equal(a, b) ipvx_addr_hash_equal(&(a), &(b))
+/// khash hash function for (normalized) ipvx_prefix_t prefix keys
+#define kh_ipvx_pfx_hash_func(key) ipvx_pfx_hash(&(key))
+/// khash equality function for (normalized) ipvx_prefix_t prefix keys
+#define kh_ipvx_pfx_hash_equal(a, b) ipvx_pfx_hash_equal(&(a), &(b))
+
+/// Instantiate a khash set of addresses (the mask length is ignored)
+#define KHASH_SET_INIT_IPVX(name)                                       \
+  KHASH_INIT(name, ipvx_prefix_t, char, 0, kh_ipvx_addr_hash_func,      \
+             kh_ipvx_addr_hash_equal)
+
+/// Instantiate a khash map from addresses (the mask length is ignored)
+#define KHASH_MAP_INIT_IPVX(name, khval_t)                              \
+  KHASH_INIT(name, ipvx_prefix_t, khval_t, 1, kh_ipvx_addr_hash_func,   \
+             kh_ipvx_addr_hash_equal)
+
+/// Instantiate a khash set of prefixes
+#define KHASH_SET_INIT_IPVX_PFX(name)                                   \
+  KHASH_INIT(name, ipvx_prefix_t, char, 0, kh_ipvx_pfx_hash_func,       \
+             kh_ipvx_pfx_hash_equal)
+
+/// Instantiate a khash map from prefixes
+#define KHASH_MAP_INIT_IPVX_PFX(name, khval_t)                          \
+  KHASH_INIT(name, ipvx_prefix_t, khval_t, 1, kh_ipvx_pfx_hash_func,    \
+             kh_ipvx_pfx_hash_equal)
+
 /**
  * Test whether one prefix contains another prefix or address.
  *
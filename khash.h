@@ -128,6 +128,9 @@ int main() {
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
+#ifdef KHASH_STATS
+#include <time.h>
+#endif
 
 /* compiler specific configuration */
 
@@ -160,7 +163,12 @@ typedef unsigned long long khint64_t;
 #define kh_inline inline
 #endif
 
+#ifdef KHASH_64
+/* allow more than 2^32 buckets; hash functions should return 64-bit values */
+typedef khint64_t khint_t;
+#else
 typedef khint32_t khint_t;
+#endif
 typedef khint_t khiter_t;
 
 #define __ac_isempty(flag, i) ((flag[i>>4]>>((i&0xfU)<<1))&2)
@@ -170,12 +178,36 @@ typedef khint_t khiter_t;
 #define __ac_set_isempty_false(flag, i) (flag[i>>4]&=~(2ul<<((i&0xfU)<<1)))
 #define __ac_set_isboth_false(flag, i) (flag[i>>4]&=~(3ul<<((i&0xfU)<<1)))
 #define __ac_set_isdel_true(flag, i) (flag[i>>4]|=1ul<<((i&0xfU)<<1))
+#define __ac_set_isempty_true(flag, i) (flag[i>>4]|=2ul<<((i&0xfU)<<1))
+
+/* next bucket in the probe sequence: quadratic by default, linear if requested */
+#define __ac_probe_next(i, step, mask, linear) (((i) + ((linear)? 1 : ++(step))) & (mask))
 
 #define __ac_fsize(m) ((m) < 16? 1 : (m)>>4)
 
+#if __GNUC__ >= 3
+#define __ac_prefetch(p) __builtin_prefetch(p)
+#else
+#define __ac_prefetch(p) ((void)0)
+#endif
+
+/* number of keys hashed and prefetched ahead by the batched functions */
+#ifndef KH_BATCH_SIZE
+#define KH_BATCH_SIZE 16
+#endif
+
 #ifndef kroundup32
 #define kroundup32(x) (--(x), (x)|=(x)>>1, (x)|=(x)>>2, (x)|=(x)>>4, (x)|=(x)>>8, (x)|=(x)>>16, ++(x))
 #endif
+#ifndef kroundup64
+#define kroundup64(x) (--(x), (x)|=(x)>>1, (x)|=(x)>>2, (x)|=(x)>>4, (x)|=(x)>>8, (x)|=(x)>>16, (x)|=(x)>>32, ++(x))
+#endif
+
+#ifdef KHASH_64
+#define __ac_roundup(x) kroundup64(x)
+#else
+#define __ac_roundup(x) kroundup32(x)
+#endif
 
 #ifndef kcalloc
 #define kcalloc(N,Z) calloc(N,Z)
@@ -190,34 +222,128 @@ typedef khint_t khiter_t;
 #define kfree(P) free(P)
 #endif
 
+/*
+  Bucket arrays are allocated through an allocator given to KHASH_INIT_ALLOC as
+  a prefix; __alloc##_alloc(size), __alloc##_realloc(ptr, old_size, new_size)
+  and __alloc##_free(ptr, size) must behave like their libc counterparts, and
+  are also told the current size of the block. kh_libc, used by all other
+  KHASH_INIT variants, maps onto the kmalloc family above.
+ */
+#define kh_libc_alloc(Z) kmalloc(Z)
+#define kh_libc_realloc(P,O,Z) krealloc(P,Z)
+#define kh_libc_free(P,Z) ((void)(Z), kfree(P))
+
 static const double __ac_HASH_UPPER = 0.77;
 
+/*
+  kh_key() and kh_val() step through the keys and vals arrays using the
+  element sizes recorded (at no cost) by these zero-length members, which lets
+  KHASH_INIT_KV tables interleave keys and values in a single array.
+ */
+#if __GNUC__ >= 3
+#define __KH_STRIDES(kstep_t, vstep_t) kstep_t __kh_kstep[0]; vstep_t __kh_vstep[0];
+#define __kh_kstride(h) sizeof((h)->__kh_kstep[0])
+#define __kh_vstride(h) sizeof((h)->__kh_vstep[0])
+#define __kh_elem(h, arr, stride, x) (*(__typeof__((h)->arr))((char *)(h)->arr + (size_t)(x) * (stride)))
+#define __KH_KV_CHECK(name)
+#else
+#define __KH_STRIDES(kstep_t, vstep_t)
+#define __kh_kstride(h) sizeof(*(h)->keys)
+#define __kh_vstride(h) sizeof(*(h)->vals)
+/* without strides, kh_key()/kh_val() would index the wrong buckets of a
+   KHASH_INIT_KV table, so refuse to instantiate one */
+#define __KH_KV_CHECK(name) typedef char kh_##name##_KHASH_INIT_KV_requires_GCC[-1];
+#endif
+
+/*
+  With KHASH_STATS defined (consistently, in every file that uses a given
+  table type), each table also counts its resizes and the time spent in them;
+  see kh_stats().
+ */
+#ifdef KHASH_STATS
+#define __KH_STATS_FIELDS unsigned long long n_resizes, resize_ns;
+#define __KH_STATS_START(t) unsigned long long t = __kh_now_ns();
+#define __kh_stats_resized(h, t) ((h)->n_resizes++, (h)->resize_ns += __kh_now_ns() - (t))
+#define __kh_stats_n_resizes(h) ((h)->n_resizes)
+#define __kh_stats_resize_ns(h) ((h)->resize_ns)
+UNUSED static kh_inline unsigned long long __kh_now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#else
+#define __KH_STATS_FIELDS
+#define __KH_STATS_START(t)
+#define __kh_stats_resized(h, t) ((void)0)
+#define __kh_stats_n_resizes(h) 0
+#define __kh_stats_resize_ns(h) 0
+#endif
+
+/*! @typedef
+  @abstract     Statistics about a hash table, filled by kh_stats()
+ */
+typedef struct kh_stats {
+	khint_t size, n_buckets;
+	khint_t n_tombstones;		/* "deleted" markers: n_occupied - size */
+	double load_factor;			/* size / n_buckets */
+	double avg_probe;			/* mean number of buckets examined to find a present key */
+	khint_t max_probe;			/* longest such probe sequence */
+	unsigned long long n_resizes;	/* number of rehashes (KHASH_STATS only) */
+	double resize_time;			/* seconds spent rehashing (KHASH_STATS only) */
+} kh_stats_t;
+
 #define __KHASH_TYPE(name, khkey_t, khval_t) \
 	typedef struct { \
 		khint_t n_buckets, size, n_occupied, upper_bound; \
 		khint32_t *flags; \
 		khkey_t *keys; \
 		khval_t *vals; \
+		khint_t seed; \
+		__KH_STATS_FIELDS \
+		__KH_STRIDES(khkey_t, khval_t) \
 	} kh_##name##_t;
 
 #define __KHASH_PROTOTYPES(name, khkey_t, khval_t)	 					\
 	extern kh_##name##_t *kh_init_##name(void);							\
+	extern kh_##name##_t *kh_init_seed_##name(khint_t seed);			\
 	extern void kh_destroy_##name(kh_##name##_t *h);					\
 	extern void kh_clear_##name(kh_##name##_t *h);						\
 	extern khint_t kh_get_##name(const kh_##name##_t *h, khkey_t key); 	\
 	extern int kh_resize_##name(kh_##name##_t *h, khint_t new_n_buckets); \
 	extern khint_t kh_put_##name(kh_##name##_t *h, khkey_t key, int *ret); \
-	extern void kh_del_##name(kh_##name##_t *h, khint_t x);
+	extern void kh_del_##name(kh_##name##_t *h, khint_t x);				\
+	extern void kh_get_batch_##name(const kh_##name##_t *h, const khkey_t *keys, khint_t n, khint_t *out); \
+	extern int kh_put_batch_##name(kh_##name##_t *h, const khkey_t *keys, khint_t n, khint_t *out, int *rets); \
+	extern void kh_stats_##name(const kh_##name##_t *h, kh_stats_t *st);
 
-#define __KHASH_IMPL(name, SCOPE, khkey_t, khval_t, kh_is_map, __hash_func, __hash_equal) \
+#define __KHASH_HASHER(name, SCOPE, khkey_t, __hash_func)				\
+	SCOPE khint_t __kh_hash_##name(const kh_##name##_t *h, khkey_t key)	\
+	{																	\
+		(void)h;														\
+		return (khint_t)__hash_func(key);								\
+	}
+
+#define __KHASH_SEEDED_HASHER(name, SCOPE, khkey_t, __hash_func)		\
+	SCOPE khint_t __kh_hash_##name(const kh_##name##_t *h, khkey_t key)	\
+	{																	\
+		return (khint_t)__hash_func(key, h->seed);						\
+	}
+
+#define __KHASH_IMPL_CORE(name, SCOPE, khkey_t, khval_t, kh_is_map, __hash_equal, kh_linear) \
 	SCOPE kh_##name##_t *kh_init_##name(void) {							\
 		return (kh_##name##_t*)kcalloc(1, sizeof(kh_##name##_t));		\
 	}																	\
+	SCOPE kh_##name##_t *kh_init_seed_##name(khint_t seed) {			\
+		kh_##name##_t *h = kh_init_##name();							\
+		if (h) h->seed = seed;											\
+		return h;														\
+	}																	\
 	SCOPE void kh_destroy_##name(kh_##name##_t *h)						\
 	{																	\
 		if (h) {														\
-			kfree((void *)h->keys); kfree(h->flags);					\
-			kfree((void *)h->vals);										\
+			__kh_free_arrays_##name(h);									\
+			__kh_free_flags_##name(h->flags, h->n_buckets);				\
 			kfree(h);													\
 		}																\
 	}																	\
@@ -228,104 +354,101 @@ static const double __ac_HASH_UPPER = 0.77;
 			h->size = h->n_occupied = 0;								\
 		}																\
 	}																	\
+	SCOPE khint_t __kh_get_at_##name(const kh_##name##_t *h, khkey_t key, khint_t i) \
+	{ /* probe for key starting at bucket i; h->n_buckets must be non-zero */ \
+		khint_t last = i, mask = h->n_buckets - 1, step = 0;			\
+		while (!__ac_isempty(h->flags, i) && (__ac_isdel(h->flags, i) || !__hash_equal(kh_key(h, i), key))) { \
+			i = __ac_probe_next(i, step, mask, kh_linear);				\
+			if (i == last) return h->n_buckets;							\
+		}																\
+		return __ac_iseither(h->flags, i)? h->n_buckets : i;			\
+	}																	\
 	SCOPE khint_t kh_get_##name(const kh_##name##_t *h, khkey_t key) 	\
 	{																	\
 		if (h->n_buckets) {												\
-			khint_t k, i, last, mask, step = 0; \
-			mask = h->n_buckets - 1;									\
-			k = __hash_func(key); i = k & mask;							\
-			last = i; \
-			while (!__ac_isempty(h->flags, i) && (__ac_isdel(h->flags, i) || !__hash_equal(h->keys[i], key))) { \
-				i = (i + (++step)) & mask; \
-				if (i == last) return h->n_buckets;						\
-			}															\
-			return __ac_iseither(h->flags, i)? h->n_buckets : i;		\
+			return __kh_get_at_##name(h, key, __kh_hash_##name(h, key) & (h->n_buckets - 1)); \
 		} else return 0;												\
 	}																	\
+	SCOPE void __kh_rehash_##name(kh_##name##_t *h, khint32_t *flags, khint_t n_buckets, khint32_t *new_flags, khint_t new_n_buckets) \
+	{ /* move the elements in place from the buckets described by flags to those described by new_flags (all empty); the arrays must be large enough for both */ \
+		khint_t j;														\
+		for (j = 0; j != n_buckets; ++j) {								\
+			if (__ac_iseither(flags, j) == 0) {							\
+				khkey_t key = kh_key(h, j);								\
+				khval_t val;											\
+				khint_t new_mask;										\
+				new_mask = new_n_buckets - 1; 							\
+				if (kh_is_map) val = kh_val(h, j);						\
+				__ac_set_isdel_true(flags, j);							\
+				while (1) { /* kick-out process; sort of like in Cuckoo hashing */ \
+					khint_t k, i, step = 0; \
+					k = __kh_hash_##name(h, key);						\
+					i = k & new_mask;									\
+					while (!__ac_isempty(new_flags, i)) i = __ac_probe_next(i, step, new_mask, kh_linear); \
+					__ac_set_isempty_false(new_flags, i);				\
+					if (i < n_buckets && __ac_iseither(flags, i) == 0) { /* kick out the existing element */ \
+						{ khkey_t tmp = kh_key(h, i); kh_key(h, i) = key; key = tmp; } \
+						if (kh_is_map) { khval_t tmp = kh_val(h, i); kh_val(h, i) = val; val = tmp; } \
+						__ac_set_isdel_true(flags, i); /* mark it as deleted in the old hash table */ \
+					} else { /* write the element and jump out of the loop */ \
+						kh_key(h, i) = key;								\
+						if (kh_is_map) kh_val(h, i) = val;				\
+						break;											\
+					}													\
+				}														\
+			}															\
+		}																\
+	}																	\
 	SCOPE int kh_resize_##name(kh_##name##_t *h, khint_t new_n_buckets) \
 	{ /* This function uses 0.25*n_buckets bytes of working space instead of [sizeof(key_t+val_t)+.25]*n_buckets. */ \
 		khint32_t *new_flags = 0;										\
 		khint_t j = 1;													\
+		__KH_STATS_START(t0)											\
 		{																\
-			kroundup32(new_n_buckets); 									\
+			__ac_roundup(new_n_buckets); 									\
 			if (new_n_buckets < 4) new_n_buckets = 4;					\
 			if (h->size >= (khint_t)(new_n_buckets * __ac_HASH_UPPER + 0.5)) j = 0;	/* requested size is too small */ \
 			else { /* hash table size to be changed (shrink or expand); rehash */ \
-				new_flags = (khint32_t*)kmalloc(__ac_fsize(new_n_buckets) * sizeof(khint32_t));	\
+				new_flags = __kh_alloc_flags_##name(new_n_buckets);		\
 				if (!new_flags) return -1;								\
 				memset(new_flags, 0xaa, __ac_fsize(new_n_buckets) * sizeof(khint32_t)); \
 				if (h->n_buckets < new_n_buckets) {	/* expand */		\
-					khkey_t *new_keys = (khkey_t*)krealloc((void *)h->keys, new_n_buckets * sizeof(khkey_t)); \
-					if (!new_keys) return -1;							\
-					h->keys = new_keys;									\
-					if (kh_is_map) {									\
-						khval_t *new_vals = (khval_t*)krealloc((void *)h->vals, new_n_buckets * sizeof(khval_t)); \
-						if (!new_vals) return -1;						\
-						h->vals = new_vals;								\
-					}													\
+					if (__kh_realloc_arrays_##name(h, new_n_buckets) < 0) { __kh_free_flags_##name(new_flags, new_n_buckets); return -1; } \
 				} /* otherwise shrink */								\
 			}															\
 		}																\
 		if (j) { /* rehashing is needed */								\
-			for (j = 0; j != h->n_buckets; ++j) {						\
-				if (__ac_iseither(h->flags, j) == 0) {					\
-					khkey_t key = h->keys[j];							\
-					khval_t val;										\
-					khint_t new_mask;									\
-					new_mask = new_n_buckets - 1; 						\
-					if (kh_is_map) val = h->vals[j];					\
-					__ac_set_isdel_true(h->flags, j);					\
-					while (1) { /* kick-out process; sort of like in Cuckoo hashing */ \
-						khint_t k, i, step = 0; \
-						k = __hash_func(key);							\
-						i = k & new_mask;								\
-						while (!__ac_isempty(new_flags, i)) i = (i + (++step)) & new_mask; \
-						__ac_set_isempty_false(new_flags, i);			\
-						if (i < h->n_buckets && __ac_iseither(h->flags, i) == 0) { /* kick out the existing element */ \
-							{ khkey_t tmp = h->keys[i]; h->keys[i] = key; key = tmp; } \
-							if (kh_is_map) { khval_t tmp = h->vals[i]; h->vals[i] = val; val = tmp; } \
-							__ac_set_isdel_true(h->flags, i); /* mark it as deleted in the old hash table */ \
-						} else { /* write the element and jump out of the loop */ \
-							h->keys[i] = key;							\
-							if (kh_is_map) h->vals[i] = val;			\
-							break;										\
-						}												\
-					}													\
-				}														\
-			}															\
+			__kh_rehash_##name(h, h->flags, h->n_buckets, new_flags, new_n_buckets); \
 			if (h->n_buckets > new_n_buckets) { /* shrink the hash table */ \
-				h->keys = (khkey_t*)krealloc((void *)h->keys, new_n_buckets * sizeof(khkey_t)); \
-				if (kh_is_map) h->vals = (khval_t*)krealloc((void *)h->vals, new_n_buckets * sizeof(khval_t)); \
+				if (__kh_realloc_arrays_##name(h, new_n_buckets) < 0) { /* move everything back, which needs no memory */ \
+					memset(h->flags, 0xaa, __ac_fsize(h->n_buckets) * sizeof(khint32_t)); \
+					__kh_rehash_##name(h, new_flags, new_n_buckets, h->flags, h->n_buckets); \
+					__kh_free_flags_##name(new_flags, new_n_buckets);	\
+					h->n_occupied = h->size;							\
+					return -1;											\
+				}														\
 			}															\
-			kfree(h->flags); /* free the working space */				\
+			__kh_free_flags_##name(h->flags, h->n_buckets); /* free the working space */ \
 			h->flags = new_flags;										\
 			h->n_buckets = new_n_buckets;								\
 			h->n_occupied = h->size;									\
 			h->upper_bound = (khint_t)(h->n_buckets * __ac_HASH_UPPER + 0.5); \
+			__kh_stats_resized(h, t0);									\
 		}																\
 		return 0;														\
 	}																	\
-	SCOPE khint_t kh_put_##name(kh_##name##_t *h, khkey_t key, int *ret) \
-	{																	\
+	SCOPE khint_t __kh_put_at_##name(kh_##name##_t *h, khkey_t key, khint_t k, int *ret) \
+	{ /* insert key with hash k; the table must have room for it */		\
 		khint_t x;														\
-		if (h->n_occupied >= h->upper_bound) { /* update the hash table */ \
-			if (h->n_buckets > (h->size<<1)) {							\
-				if (kh_resize_##name(h, h->n_buckets - 1) < 0) { /* clear "deleted" elements */ \
-					*ret = -1; return h->n_buckets;						\
-				}														\
-			} else if (kh_resize_##name(h, h->n_buckets + 1) < 0) { /* expand the hash table */ \
-				*ret = -1; return h->n_buckets;							\
-			}															\
-		} /* TODO: to implement automatically shrinking; resize() already support shrinking */ \
 		{																\
-			khint_t k, i, site, last, mask = h->n_buckets - 1, step = 0; \
-			x = site = h->n_buckets; k = __hash_func(key); i = k & mask; \
+			khint_t i, site, last, mask = h->n_buckets - 1, step = 0;	\
+			x = site = h->n_buckets; i = k & mask;						\
 			if (__ac_isempty(h->flags, i)) x = i; /* for speed up */	\
 			else {														\
 				last = i; \
-				while (!__ac_isempty(h->flags, i) && (__ac_isdel(h->flags, i) || !__hash_equal(h->keys[i], key))) { \
+				while (!__ac_isempty(h->flags, i) && (__ac_isdel(h->flags, i) || !__hash_equal(kh_key(h, i), key))) { \
 					if (__ac_isdel(h->flags, i)) site = i;				\
-					i = (i + (++step)) & mask; \
+					i = __ac_probe_next(i, step, mask, kh_linear);		\
 					if (i == last) { x = site; break; }					\
 				}														\
 				if (x == h->n_buckets) {								\
@@ -335,24 +458,114 @@ static const double __ac_HASH_UPPER = 0.77;
 			}															\
 		}																\
 		if (__ac_isempty(h->flags, x)) { /* not present at all */		\
-			h->keys[x] = key;											\
+			kh_key(h, x) = key;											\
 			__ac_set_isboth_false(h->flags, x);							\
 			++h->size; ++h->n_occupied;									\
 			*ret = 1;													\
 		} else if (__ac_isdel(h->flags, x)) { /* deleted */				\
-			h->keys[x] = key;											\
+			kh_key(h, x) = key;											\
 			__ac_set_isboth_false(h->flags, x);							\
 			++h->size;													\
 			*ret = 2;													\
-		} else *ret = 0; /* Don't touch h->keys[x] if present and not deleted */ \
+		} else *ret = 0; /* Don't touch kh_key(h, x) if present and not deleted */ \
 		return x;														\
 	}																	\
+	SCOPE khint_t kh_put_##name(kh_##name##_t *h, khkey_t key, int *ret) \
+	{																	\
+		if (h->n_occupied >= h->upper_bound) { /* update the hash table */ \
+			if (h->n_buckets > (h->size<<1)) {							\
+				if (kh_resize_##name(h, h->n_buckets - 1) < 0) { /* clear "deleted" elements */ \
+					*ret = -1; return h->n_buckets;						\
+				}														\
+			} else if (kh_resize_##name(h, h->n_buckets + 1) < 0) { /* expand the hash table */ \
+				*ret = -1; return h->n_buckets;							\
+			}															\
+		} /* TODO: to implement automatically shrinking; resize() already support shrinking */ \
+		return __kh_put_at_##name(h, key, __kh_hash_##name(h, key), ret); \
+	}																	\
 	SCOPE void kh_del_##name(kh_##name##_t *h, khint_t x)				\
 	{																	\
 		if (x != h->n_buckets && !__ac_iseither(h->flags, x)) {			\
-			__ac_set_isdel_true(h->flags, x);							\
-			--h->size;													\
+			if (kh_linear) { /* backward-shift deletion; no tombstones */ \
+				khint_t j = x, k, mask = h->n_buckets - 1;				\
+				while (1) {												\
+					j = (j + 1) & mask;									\
+					if (__ac_isempty(h->flags, j)) break;				\
+					k = __kh_hash_##name(h, kh_key(h, j)) & mask;			\
+					/* move j into the hole unless its home lies in (x, j] */ \
+					if (((j - k) & mask) >= ((j - x) & mask)) {			\
+						kh_key(h, x) = kh_key(h, j);						\
+						if (kh_is_map) kh_val(h, x) = kh_val(h, j);			\
+						x = j;											\
+					}													\
+				}														\
+				__ac_set_isempty_true(h->flags, x);						\
+				--h->size; --h->n_occupied;								\
+			} else {													\
+				__ac_set_isdel_true(h->flags, x);						\
+				--h->size;												\
+			}															\
 		}																\
+	}																	\
+	SCOPE void kh_get_batch_##name(const kh_##name##_t *h, const khkey_t *keys, khint_t n, khint_t *out) \
+	{																	\
+		khint_t hb[KH_BATCH_SIZE], b, j, cnt, mask;						\
+		if (!h->n_buckets) { for (j = 0; j < n; ++j) out[j] = 0; return; } \
+		mask = h->n_buckets - 1;										\
+		for (b = 0; b < n; b += cnt) {									\
+			cnt = n - b < KH_BATCH_SIZE ? n - b : KH_BATCH_SIZE;		\
+			for (j = 0; j < cnt; ++j) { /* hash and prefetch first... */ \
+				hb[j] = __kh_hash_##name(h, keys[b + j]) & mask;		\
+				__ac_prefetch(&h->flags[hb[j] >> 4]);					\
+				__ac_prefetch(&kh_key(h, hb[j]));							\
+			}															\
+			for (j = 0; j < cnt; ++j) { /* ...then resolve the probes */ \
+				out[b + j] = __kh_get_at_##name(h, keys[b + j], hb[j]);	\
+				if (kh_is_map && out[b + j] != h->n_buckets) __ac_prefetch(&kh_val(h, out[b + j])); \
+			}															\
+		}																\
+	}																	\
+	SCOPE int kh_put_batch_##name(kh_##name##_t *h, const khkey_t *keys, khint_t n, khint_t *out, int *rets) \
+	{																	\
+		khint_t hb[KH_BATCH_SIZE], b, j, cnt, mask;						\
+		int ret;														\
+		if (h->n_occupied + n >= h->upper_bound) { /* make room up front so no iterator is invalidated */ \
+			if (kh_resize_##name(h, (khint_t)((h->size + n) / __ac_HASH_UPPER) + 1) < 0) return -1; \
+		}																\
+		mask = h->n_buckets - 1;										\
+		for (b = 0; b < n; b += cnt) {									\
+			cnt = n - b < KH_BATCH_SIZE ? n - b : KH_BATCH_SIZE;		\
+			for (j = 0; j < cnt; ++j) {									\
+				hb[j] = __kh_hash_##name(h, keys[b + j]);				\
+				__ac_prefetch(&h->flags[(hb[j] & mask) >> 4]);			\
+				__ac_prefetch(&kh_key(h, hb[j] & mask));					\
+			}															\
+			for (j = 0; j < cnt; ++j) {									\
+				out[b + j] = __kh_put_at_##name(h, keys[b + j], hb[j], &ret); \
+				if (rets) rets[b + j] = ret;							\
+			}															\
+		}																\
+		return 0;														\
+	}																	\
+	SCOPE void kh_stats_##name(const kh_##name##_t *h, kh_stats_t *st)	\
+	{ /* replay the probe sequence of every present key */			\
+		khint_t j, i, step, len, mask = h->n_buckets - 1;				\
+		double total = 0;												\
+		memset(st, 0, sizeof(*st));										\
+		st->size = h->size; st->n_buckets = h->n_buckets;				\
+		st->n_tombstones = h->n_occupied - h->size;						\
+		st->n_resizes = __kh_stats_n_resizes(h);						\
+		st->resize_time = __kh_stats_resize_ns(h) / 1e9;				\
+		if (!h->n_buckets) return;										\
+		st->load_factor = (double)h->size / h->n_buckets;				\
+		for (j = 0; j != h->n_buckets; ++j) {							\
+			if (__ac_iseither(h->flags, j)) continue;					\
+			i = __kh_hash_##name(h, kh_key(h, j)) & mask;				\
+			for (step = 0, len = 1; i != j; ++len) i = __ac_probe_next(i, step, mask, kh_linear); \
+			total += len;												\
+			if (len > st->max_probe) st->max_probe = len;				\
+		}																\
+		if (h->size) st->avg_probe = total / h->size;					\
 	}								\
 									\
 	SCOPE void kh_free_##name(kh_##name##_t *h,			\
@@ -381,6 +594,89 @@ static const double __ac_HASH_UPPER = 0.77;
 	    }								\
 	}
 
+#define __KHASH_FLAGS(name, SCOPE, __alloc)								\
+	SCOPE khint32_t *__kh_alloc_flags_##name(khint_t n_buckets)			\
+	{																	\
+		return (khint32_t*)__alloc##_alloc((size_t)__ac_fsize(n_buckets) * sizeof(khint32_t)); \
+	}																	\
+	SCOPE void __kh_free_flags_##name(khint32_t *flags, khint_t n_buckets) \
+	{																	\
+		if (flags) __alloc##_free((void *)flags, (size_t)__ac_fsize(n_buckets) * sizeof(khint32_t)); \
+	}
+
+/* h->n_buckets is the current size of the arrays when these are called */
+#define __KHASH_ARRAYS(name, SCOPE, khkey_t, khval_t, kh_is_map, __alloc) \
+	__KHASH_FLAGS(name, SCOPE, __alloc)									\
+	SCOPE int __kh_realloc_arrays_##name(kh_##name##_t *h, khint_t n_buckets) \
+	{																	\
+		khkey_t *new_keys = (khkey_t*)__alloc##_realloc((void *)h->keys, (size_t)h->n_buckets * sizeof(khkey_t), (size_t)n_buckets * sizeof(khkey_t)); \
+		if (!new_keys) return -1;										\
+		h->keys = new_keys;												\
+		if (kh_is_map) {												\
+			khval_t *new_vals = (khval_t*)__alloc##_realloc((void *)h->vals, (size_t)h->n_buckets * sizeof(khval_t), (size_t)n_buckets * sizeof(khval_t)); \
+			if (!new_vals) { /* keep keys at the size h->n_buckets says they are */ \
+				if (h->n_buckets == 0) {								\
+					__alloc##_free((void *)h->keys, (size_t)n_buckets * sizeof(khkey_t)); \
+					h->keys = 0;										\
+				} else if ((new_keys = (khkey_t*)__alloc##_realloc((void *)h->keys, (size_t)n_buckets * sizeof(khkey_t), (size_t)h->n_buckets * sizeof(khkey_t))) != 0) \
+					h->keys = new_keys;									\
+				return -1;												\
+			}															\
+			h->vals = new_vals;											\
+		}																\
+		return 0;														\
+	}																	\
+	SCOPE void __kh_free_arrays_##name(kh_##name##_t *h)				\
+	{																	\
+		if (h->keys) __alloc##_free((void *)h->keys, (size_t)h->n_buckets * sizeof(khkey_t)); \
+		if (h->vals) __alloc##_free((void *)h->vals, (size_t)h->n_buckets * sizeof(khval_t)); \
+	}
+
+#define __KHASH_IMPL(name, SCOPE, khkey_t, khval_t, kh_is_map, __hash_func, __hash_equal) \
+	__KHASH_HASHER(name, SCOPE, khkey_t, __hash_func)					\
+	__KHASH_ARRAYS(name, SCOPE, khkey_t, khval_t, kh_is_map, kh_libc)	\
+	__KHASH_IMPL_CORE(name, SCOPE, khkey_t, khval_t, kh_is_map, __hash_equal, 0)
+
+#define __KHASH_IMPL_SEEDED(name, SCOPE, khkey_t, khval_t, kh_is_map, __hash_func, __hash_equal) \
+	__KHASH_SEEDED_HASHER(name, SCOPE, khkey_t, __hash_func)			\
+	__KHASH_ARRAYS(name, SCOPE, khkey_t, khval_t, kh_is_map, kh_libc)	\
+	__KHASH_IMPL_CORE(name, SCOPE, khkey_t, khval_t, kh_is_map, __hash_equal, 0)
+
+#define __KHASH_IMPL_LINEAR(name, SCOPE, khkey_t, khval_t, kh_is_map, __hash_func, __hash_equal) \
+	__KHASH_HASHER(name, SCOPE, khkey_t, __hash_func)					\
+	__KHASH_ARRAYS(name, SCOPE, khkey_t, khval_t, kh_is_map, kh_libc)	\
+	__KHASH_IMPL_CORE(name, SCOPE, khkey_t, khval_t, kh_is_map, __hash_equal, 1)
+
+#define __KHASH_KV_TYPE(name, khkey_t, khval_t) \
+	__KH_KV_CHECK(name) \
+	typedef struct { \
+		khkey_t key; \
+		khval_t val; \
+	} kh_##name##_kv_t; \
+	typedef struct { \
+		khint_t n_buckets, size, n_occupied, upper_bound; \
+		khint32_t *flags; \
+		khkey_t *keys; /* &kvs[0].key */ \
+		khval_t *vals; /* &kvs[0].val */ \
+		khint_t seed; \
+		__KH_STATS_FIELDS \
+		__KH_STRIDES(kh_##name##_kv_t, kh_##name##_kv_t) \
+	} kh_##name##_t;
+
+#define __KHASH_KV_ARRAYS(name, SCOPE, khkey_t, khval_t, __alloc)		\
+	__KHASH_FLAGS(name, SCOPE, __alloc)									\
+	SCOPE int __kh_realloc_arrays_##name(kh_##name##_t *h, khint_t n_buckets) \
+	{																	\
+		kh_##name##_kv_t *kvs = (kh_##name##_kv_t*)__alloc##_realloc((void *)h->keys, (size_t)h->n_buckets * sizeof(kh_##name##_kv_t), (size_t)n_buckets * sizeof(kh_##name##_kv_t)); \
+		if (!kvs) return -1;											\
+		h->keys = &kvs->key; h->vals = &kvs->val;						\
+		return 0;														\
+	}																	\
+	SCOPE void __kh_free_arrays_##name(kh_##name##_t *h)				\
+	{																	\
+		if (h->keys) __alloc##_free((void *)h->keys, (size_t)h->n_buckets * sizeof(kh_##name##_kv_t)); \
+	}
+
 #define KHASH_DECLARE(name, khkey_t, khval_t)		 					\
 	__KHASH_TYPE(name, khkey_t, khval_t) 								\
 	__KHASH_PROTOTYPES(name, khkey_t, khval_t)
@@ -392,6 +688,314 @@ static const double __ac_HASH_UPPER = 0.77;
 #define KHASH_INIT(name, khkey_t, khval_t, kh_is_map, __hash_func, __hash_equal) \
 	KHASH_INIT2(name, UNUSED static kh_inline, khkey_t, khval_t, kh_is_map, __hash_func, __hash_equal)
 
+#define KHASH_INIT2_SEEDED(name, SCOPE, khkey_t, khval_t, kh_is_map, __hash_func, __hash_equal) \
+	__KHASH_TYPE(name, khkey_t, khval_t) 								\
+	__KHASH_IMPL_SEEDED(name, SCOPE, khkey_t, khval_t, kh_is_map, __hash_func, __hash_equal)
+
+#define KHASH_INIT2_LINEAR(name, SCOPE, khkey_t, khval_t, kh_is_map, __hash_func, __hash_equal) \
+	__KHASH_TYPE(name, khkey_t, khval_t) 								\
+	__KHASH_IMPL_LINEAR(name, SCOPE, khkey_t, khval_t, kh_is_map, __hash_func, __hash_equal)
+
+/*! @function
+  @abstract     Instantiate a hash table that uses linear probing and
+                backward-shift deletion
+  @discussion   Takes the same arguments as KHASH_INIT. kh_del() never leaves
+                a "deleted" marker behind, so tables with heavy churn keep
+                short probe sequences without periodic rehashing. Linear
+                probing is sensitive to clustering, so use a well-mixing hash
+                function (e.g., kh_int_mix_hash_func).
+
+                kh_del() may move a later element into the deleted bucket.
+                When deleting while iterating, re-examine the current bucket
+                after kh_del() instead of advancing; an element may then be
+                visited twice if it was shifted across the end of the table.
+ */
+#define KHASH_INIT_LINEAR(name, khkey_t, khval_t, kh_is_map, __hash_func, __hash_equal) \
+	KHASH_INIT2_LINEAR(name, UNUSED static kh_inline, khkey_t, khval_t, kh_is_map, __hash_func, __hash_equal)
+
+#define KHASH_INIT2_ALLOC(name, SCOPE, khkey_t, khval_t, kh_is_map, __hash_func, __hash_equal, __alloc) \
+	__KHASH_TYPE(name, khkey_t, khval_t) 								\
+	__KHASH_HASHER(name, SCOPE, khkey_t, __hash_func)					\
+	__KHASH_ARRAYS(name, SCOPE, khkey_t, khval_t, kh_is_map, __alloc)	\
+	__KHASH_IMPL_CORE(name, SCOPE, khkey_t, khval_t, kh_is_map, __hash_equal, 0)
+
+/*! @function
+  @abstract     Instantiate a hash table whose buckets come from a custom
+                allocator
+  @discussion   Takes the same arguments as KHASH_INIT, followed by the prefix
+                of the allocator functions (see kh_libc_alloc above) used for
+                the flags, keys and vals arrays. The table header itself is
+                still allocated with kcalloc. khash_hugepage.h provides
+                kh_hugepage, which backs large arrays with transparent huge
+                pages.
+ */
+#define KHASH_INIT_ALLOC(name, khkey_t, khval_t, kh_is_map, __hash_func, __hash_equal, __alloc) \
+	KHASH_INIT2_ALLOC(name, UNUSED static kh_inline, khkey_t, khval_t, kh_is_map, __hash_func, __hash_equal, __alloc)
+
+#define KHASH_INIT2_KV(name, SCOPE, khkey_t, khval_t, kh_is_map, __hash_func, __hash_equal) \
+	__KHASH_KV_TYPE(name, khkey_t, khval_t)								\
+	__KHASH_HASHER(name, SCOPE, khkey_t, __hash_func)					\
+	__KHASH_KV_ARRAYS(name, SCOPE, khkey_t, khval_t, kh_libc)			\
+	__KHASH_IMPL_CORE(name, SCOPE, khkey_t, khval_t, kh_is_map, __hash_equal, 0)
+
+/*! @function
+  @abstract     Instantiate a hash table that stores each key next to its value
+  @discussion   Takes the same arguments as KHASH_INIT. Keys and values are
+                interleaved in a single array of buckets, so that a successful
+                lookup in a map of small keys and values touches one cache
+                line of the bucket array (plus one of the, 16x denser, flags
+                array) instead of two. kh_key(), kh_val() and kh_foreach()
+                work as usual; code that indexes h->keys or h->vals directly
+                must be changed to use them. Requires GCC or a compatible
+                compiler; other compilers fail to instantiate the table.
+ */
+#define KHASH_INIT_KV(name, khkey_t, khval_t, kh_is_map, __hash_func, __hash_equal) \
+	KHASH_INIT2_KV(name, UNUSED static kh_inline, khkey_t, khval_t, kh_is_map, __hash_func, __hash_equal)
+
+/*! @function
+  @abstract     Instantiate a hash table with a per-table hash seed
+  @discussion   Takes the same arguments as KHASH_INIT, except that
+                __hash_func is called as __hash_func(key, seed), where seed is
+                the khint_t given to kh_init_seed() (0 for kh_init()).
+ */
+#define KHASH_INIT_SEEDED(name, khkey_t, khval_t, kh_is_map, __hash_func, __hash_equal) \
+	KHASH_INIT2_SEEDED(name, UNUSED static kh_inline, khkey_t, khval_t, kh_is_map, __hash_func, __hash_equal)
+
+/* --- BEGIN OF INCREMENTAL RESIZE VARIANT --- */
+
+/*
+  Tables instantiated with KHASH_INIT_INCREMENTAL (or KHASH_INIT2_INCREMENTAL)
+  never rehash all buckets in one go when they grow. Instead, the old bucket
+  arrays are kept alongside the new ones and every kh_put/kh_get migrates at
+  most KH_INC_MIGRATE_STEP old buckets, which bounds the worst-case latency of
+  a single call. The usual kh_* interface applies, with the following caveats:
+
+	* kh_get() takes a non-const table since it may migrate buckets.
+
+	* Iteration (kh_begin/kh_end, kh_foreach) only covers the new bucket
+	  array. Call kh_rehash_finish() before iterating over the table.
+
+	* kh_resize() is synchronous, i.e., it completes the rehash before it
+	  returns. So is kh_put_batch(), which completes any pending migration
+	  first; kh_get_batch() migrates the keys it finds in the old arrays.
+
+	* kh_stats() covers the elements of both the new and the old arrays, but
+	  n_buckets and load_factor only describe the new arrays.
+
+  Both bucket arrays come from the allocator given to
+  KHASH_INIT_INCREMENTAL_ALLOC (kh_libc for KHASH_INIT_INCREMENTAL).
+ */
+
+#ifndef KH_INC_MIGRATE_STEP
+#define KH_INC_MIGRATE_STEP 64
+#endif
+
+#define __KHASH_INC_TYPE(name, khkey_t, khval_t) \
+	typedef struct kh_##name##_s { \
+		khint_t n_buckets, size, n_occupied, upper_bound; \
+		khint32_t *flags; \
+		khkey_t *keys; \
+		khval_t *vals; \
+		khint_t seed; \
+		__KH_STATS_FIELDS \
+		struct kh_##name##_s *old; /* buckets still to be migrated, if any */ \
+		khint_t migrate_pos; \
+		__KH_STRIDES(khkey_t, khval_t) \
+	} kh_##name##_t; \
+	typedef kh_##name##_t kh_##name##__inc_t;
+
+/* The incremental functions, on top of a regular table instantiated as
+   name##__inc for both the new buckets (h itself) and the old ones (h->old).
+   h->size counts the elements of both, h->old->size those not yet migrated. */
+#define __KHASH_INC_IMPL(name, SCOPE, khkey_t, khval_t, kh_is_map)		\
+	SCOPE void __kh_inc_free_old_##name(kh_##name##_t *h)				\
+	{																	\
+		kh_destroy_##name##__inc(h->old);								\
+		h->old = 0; h->migrate_pos = 0;									\
+	}																	\
+	SCOPE kh_##name##_t *kh_init_##name(void) {							\
+		return kh_init_##name##__inc();									\
+	}																	\
+	SCOPE kh_##name##_t *kh_init_seed_##name(khint_t seed) {			\
+		return kh_init_seed_##name##__inc(seed);						\
+	}																	\
+	SCOPE void kh_destroy_##name(kh_##name##_t *h)						\
+	{																	\
+		if (h) {														\
+			__kh_inc_free_old_##name(h);								\
+			kh_destroy_##name##__inc(h);								\
+		}																\
+	}																	\
+	SCOPE void kh_clear_##name(kh_##name##_t *h)						\
+	{																	\
+		if (h && h->flags) {											\
+			__kh_inc_free_old_##name(h);								\
+			kh_clear_##name##__inc(h);									\
+		}																\
+	}																	\
+	SCOPE khint_t __kh_inc_move_##name(kh_##name##_t *h, khint_t j, khint_t x) \
+	{ /* move bucket j of the old arrays to bucket x of the new ones, just claimed by __kh_put_at */ \
+		kh_key(h, x) = kh_key(h->old, j);								\
+		if (kh_is_map) kh_val(h, x) = kh_val(h->old, j);				\
+		--h->size; /* __kh_put_at counted it again */					\
+		kh_del_##name##__inc(h->old, j);								\
+		return x;														\
+	}																	\
+	SCOPE khint_t __kh_inc_pull_##name(kh_##name##_t *h, khkey_t key, khint_t k) \
+	{ /* look key (with hash k) up in the old arrays, and move it to the new ones if it is there */ \
+		int ret;														\
+		khint_t j = __kh_get_at_##name##__inc(h->old, key, k & (h->old->n_buckets - 1)); \
+		if (j == h->old->n_buckets) return h->n_buckets;				\
+		return __kh_inc_move_##name(h, j, __kh_put_at_##name##__inc(h, kh_key(h->old, j), k, &ret)); \
+	}																	\
+	SCOPE void kh_rehash_step_##name(kh_##name##_t *h, khint_t n)		\
+	{																	\
+		int ret;														\
+		if (!h->old) return;											\
+		while (n-- && h->old->size && h->migrate_pos < h->old->n_buckets) { \
+			if (kh_exist(h->old, h->migrate_pos)) {						\
+				khkey_t key = kh_key(h->old, h->migrate_pos);			\
+				__kh_inc_move_##name(h, h->migrate_pos, __kh_put_at_##name##__inc(h, key, __kh_hash_##name##__inc(h, key), &ret)); \
+			}															\
+			++h->migrate_pos;											\
+		}																\
+		if (!h->old->size || h->migrate_pos == h->old->n_buckets)		\
+			__kh_inc_free_old_##name(h);								\
+	}																	\
+	SCOPE void kh_rehash_finish_##name(kh_##name##_t *h)				\
+	{																	\
+		if (h->old) kh_rehash_step_##name(h, h->old->n_buckets);		\
+	}																	\
+	SCOPE int __kh_inc_start_##name(kh_##name##_t *h, khint_t new_n_buckets) \
+	{ /* allocate new arrays and retire the current ones to h->old; no migration may be in progress */ \
+		kh_##name##_t *old;												\
+		__KH_STATS_START(t0)											\
+		__ac_roundup(new_n_buckets);									\
+		if (new_n_buckets < 4) new_n_buckets = 4;						\
+		if (h->size >= (khint_t)(new_n_buckets * __ac_HASH_UPPER + 0.5)) return 0; /* requested size is too small */ \
+		if (!(old = kh_init_##name##__inc())) return -1;				\
+		*old = *h;														\
+		h->keys = 0; h->vals = 0; h->n_buckets = 0;						\
+		if (!(h->flags = __kh_alloc_flags_##name##__inc(new_n_buckets)) || \
+			__kh_realloc_arrays_##name##__inc(h, new_n_buckets) < 0) {	\
+			__kh_free_flags_##name##__inc(h->flags, new_n_buckets);		\
+			*h = *old;													\
+			kfree(old);													\
+			return -1;													\
+		}																\
+		memset(h->flags, 0xaa, __ac_fsize(new_n_buckets) * sizeof(khint32_t)); \
+		h->n_buckets = new_n_buckets;									\
+		h->n_occupied = 0;												\
+		h->upper_bound = (khint_t)(h->n_buckets * __ac_HASH_UPPER + 0.5); \
+		if (old->size) h->old = old;									\
+		else kh_destroy_##name##__inc(old);								\
+		__kh_stats_resized(h, t0);										\
+		return 0;														\
+	}																	\
+	SCOPE khint_t kh_get_##name(kh_##name##_t *h, khkey_t key)			\
+	{																	\
+		khint_t k, x;													\
+		if (h->old) kh_rehash_step_##name(h, KH_INC_MIGRATE_STEP);		\
+		if (!h->n_buckets) return 0;									\
+		k = __kh_hash_##name##__inc(h, key);							\
+		x = __kh_get_at_##name##__inc(h, key, k & (h->n_buckets - 1));	\
+		if (x == h->n_buckets && h->old) x = __kh_inc_pull_##name(h, key, k); \
+		return x;														\
+	}																	\
+	SCOPE int kh_resize_##name(kh_##name##_t *h, khint_t new_n_buckets)	\
+	{																	\
+		kh_rehash_finish_##name(h);										\
+		return kh_resize_##name##__inc(h, new_n_buckets);				\
+	}																	\
+	SCOPE khint_t kh_put_##name(kh_##name##_t *h, khkey_t key, int *ret) \
+	{																	\
+		khint_t k, x;													\
+		if (h->old) kh_rehash_step_##name(h, KH_INC_MIGRATE_STEP);		\
+		if (h->n_occupied >= h->upper_bound) {							\
+			/* new arrays filled up before the migration completed */	\
+			kh_rehash_finish_##name(h);									\
+			if (__kh_inc_start_##name(h, h->n_buckets > (h->size<<1) ? h->n_buckets - 1 : h->n_buckets + 1) < 0) { \
+				*ret = -1; return h->n_buckets;							\
+			}															\
+		}																\
+		k = __kh_hash_##name##__inc(h, key);							\
+		x = __kh_put_at_##name##__inc(h, key, k, ret);					\
+		if (*ret && h->old) { /* not in the new arrays, but maybe in the old ones */ \
+			khint_t j = __kh_get_at_##name##__inc(h->old, key, k & (h->old->n_buckets - 1)); \
+			if (j != h->old->n_buckets) {								\
+				__kh_inc_move_##name(h, j, x);							\
+				*ret = 0;												\
+			}															\
+		}																\
+		return x;														\
+	}																	\
+	SCOPE void kh_del_##name(kh_##name##_t *h, khint_t x)				\
+	{																	\
+		kh_del_##name##__inc(h, x);										\
+	}																	\
+	SCOPE void kh_get_batch_##name(kh_##name##_t *h, const khkey_t *keys, khint_t n, khint_t *out) \
+	{																	\
+		khint_t j;														\
+		if (h->old) kh_rehash_step_##name(h, KH_INC_MIGRATE_STEP);		\
+		kh_get_batch_##name##__inc(h, keys, n, out);					\
+		if (h->old) { /* moving a key never moves another, so earlier results stay valid */ \
+			for (j = 0; j < n; ++j)										\
+				if (out[j] == h->n_buckets) out[j] = __kh_inc_pull_##name(h, keys[j], __kh_hash_##name##__inc(h, keys[j])); \
+		}																\
+	}																	\
+	SCOPE int kh_put_batch_##name(kh_##name##_t *h, const khkey_t *keys, khint_t n, khint_t *out, int *rets) \
+	{																	\
+		kh_rehash_finish_##name(h);										\
+		return kh_put_batch_##name##__inc(h, keys, n, out, rets);		\
+	}																	\
+	SCOPE void kh_stats_##name(const kh_##name##_t *h, kh_stats_t *st)	\
+	{ /* combine the probe lengths of the new and the old arrays */		\
+		kh_stats_t o;													\
+		kh_stats_##name##__inc(h, st);									\
+		if (!h->old) return;											\
+		kh_stats_##name##__inc(h->old, &o);								\
+		st->n_tombstones = h->n_occupied - (h->size - h->old->size);	\
+		st->avg_probe = (st->avg_probe * h->size + o.avg_probe * o.size) / h->size; \
+		if (o.max_probe > st->max_probe) st->max_probe = o.max_probe;	\
+	}																	\
+	SCOPE void kh_free_##name(kh_##name##_t *h, void (*func)(khkey_t key)) \
+	{																	\
+		kh_rehash_finish_##name(h);										\
+		kh_free_##name##__inc(h, func);									\
+	}																	\
+	SCOPE void kh_free_vals_##name(kh_##name##_t *h, void (*func)(khval_t key)) \
+	{																	\
+		kh_rehash_finish_##name(h);										\
+		kh_free_vals_##name##__inc(h, func);							\
+	}
+
+#define KHASH_INIT2_INCREMENTAL_ALLOC(name, SCOPE, khkey_t, khval_t, kh_is_map, __hash_func, __hash_equal, __alloc) \
+	__KHASH_INC_TYPE(name, khkey_t, khval_t)							\
+	__KHASH_HASHER(name##__inc, SCOPE, khkey_t, __hash_func)			\
+	__KHASH_ARRAYS(name##__inc, SCOPE, khkey_t, khval_t, kh_is_map, __alloc) \
+	__KHASH_IMPL_CORE(name##__inc, SCOPE, khkey_t, khval_t, kh_is_map, __hash_equal, 0) \
+	__KHASH_INC_IMPL(name, SCOPE, khkey_t, khval_t, kh_is_map)
+
+#define KHASH_INIT2_INCREMENTAL(name, SCOPE, khkey_t, khval_t, kh_is_map, __hash_func, __hash_equal) \
+	KHASH_INIT2_INCREMENTAL_ALLOC(name, SCOPE, khkey_t, khval_t, kh_is_map, __hash_func, __hash_equal, kh_libc)
+
+/*! @function
+  @abstract     Instantiate a hash table that resizes incrementally
+  @discussion   Takes the same arguments as KHASH_INIT.
+ */
+#define KHASH_INIT_INCREMENTAL(name, khkey_t, khval_t, kh_is_map, __hash_func, __hash_equal) \
+	KHASH_INIT2_INCREMENTAL(name, UNUSED static kh_inline, khkey_t, khval_t, kh_is_map, __hash_func, __hash_equal)
+
+/*! @function
+  @abstract     Instantiate a hash table that resizes incrementally, with
+                buckets from a custom allocator
+  @discussion   Takes the same arguments as KHASH_INIT_ALLOC.
+ */
+#define KHASH_INIT_INCREMENTAL_ALLOC(name, khkey_t, khval_t, kh_is_map, __hash_func, __hash_equal, __alloc) \
+	KHASH_INIT2_INCREMENTAL_ALLOC(name, UNUSED static kh_inline, khkey_t, khval_t, kh_is_map, __hash_func, __hash_equal, __alloc)
+
+/* --- END OF INCREMENTAL RESIZE VARIANT --- */
+
 /* --- BEGIN OF HASH FUNCTIONS --- */
 
 /*! @function
@@ -409,7 +1013,7 @@ static const double __ac_HASH_UPPER = 0.77;
   @param  key   The integer [khint64_t]
   @return       The hash value [khint_t]
  */
-#define kh_int64_hash_func(key) (khint32_t)((key)>>33^(key)^(key)<<11)
+#define kh_int64_hash_func(key) (khint_t)((key)>>33^(key)^(key)<<11)
 /*! @function
   @abstract     64-bit integer comparison function
  */
@@ -446,7 +1050,132 @@ UNUSED static kh_inline khint_t __ac_Wang_hash(khint_t key)
     key ^=  (key >> 16);
     return key;
 }
-#define kh_int_hash_func2(k) __ac_Wang_hash((khint_t)key)
+#define kh_int_hash_func2(k) __ac_Wang_hash((khint_t)(k))
+
+/*
+  Fast, well-mixing hash functions in the style of wyhash. These spread
+  clustered keys (e.g., IPv4 addresses from a handful of /16s) over all
+  bits of the hash, which matters since khash masks off the low bits to
+  select a bucket. They return a full khint_t (64 bits with KHASH_64).
+ */
+
+#define __ac_WY_P0 0xa0761d6478bd642fULL
+#define __ac_WY_P1 0xe7037ed1a0b428dbULL
+#define __ac_WY_P2 0x8ebc6af09c88c6e3ULL
+
+/*! @function
+  @abstract     Multiply two 64-bit values and fold the 128-bit product
+ */
+UNUSED static kh_inline khint64_t __ac_wymix(khint64_t a, khint64_t b)
+{
+#ifdef __SIZEOF_INT128__
+	__uint128_t r = (__uint128_t)a * b;
+	return (khint64_t)r ^ (khint64_t)(r >> 64);
+#else
+	khint64_t ha = a >> 32, hb = b >> 32, la = (khint32_t)a, lb = (khint32_t)b;
+	khint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+	khint64_t t = rl + (rm0 << 32), c = t < rl, lo, hi;
+	lo = t + (rm1 << 32); c += lo < t;
+	hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+	return lo ^ hi;
+#endif
+}
+
+/*! @function
+  @abstract     Reduce a 64-bit hash to a khint_t
+ */
+UNUSED static kh_inline khint_t __ac_fold64(khint64_t h)
+{
+	return sizeof(khint_t) < sizeof(khint64_t) ? (khint_t)(h ^ (h >> 32)) : (khint_t)h;
+}
+
+UNUSED static kh_inline khint64_t __ac_wy_read64(const unsigned char *p)
+{
+	khint64_t v; memcpy(&v, p, sizeof(v)); return v;
+}
+
+UNUSED static kh_inline khint64_t __ac_wy_read32(const unsigned char *p)
+{
+	khint32_t v; memcpy(&v, p, sizeof(v)); return v;
+}
+
+/*! @function
+  @abstract     Hash an arbitrary buffer
+  @param  buf   Pointer to the data
+  @param  len   Length of the data in bytes
+  @param  seed  Seed value
+  @return       The hash value [khint64_t]
+ */
+UNUSED static kh_inline khint64_t __ac_wyhash64(const void *buf, size_t len, khint64_t seed)
+{
+	const unsigned char *p = (const unsigned char *)buf;
+	khint64_t a, b, h = seed ^ __ac_wymix(seed ^ __ac_WY_P0, __ac_WY_P1);
+	size_t i = len;
+	if (len <= 16) {
+		if (len >= 4) {
+			a = (__ac_wy_read32(p) << 32) | __ac_wy_read32(p + ((len >> 3) << 2));
+			b = (__ac_wy_read32(p + len - 4) << 32) | __ac_wy_read32(p + len - 4 - ((len >> 3) << 2));
+		} else if (len > 0) {
+			a = ((khint64_t)p[0] << 16) | ((khint64_t)p[len >> 1] << 8) | p[len - 1];
+			b = 0;
+		} else a = b = 0;
+	} else {
+		for (; i > 16; i -= 16, p += 16)
+			h = __ac_wymix(__ac_wy_read64(p) ^ __ac_WY_P1, __ac_wy_read64(p + 8) ^ h);
+		a = __ac_wy_read64(p + i - 16); b = __ac_wy_read64(p + i - 8);
+	}
+	return __ac_wymix(__ac_WY_P1 ^ len, __ac_wymix(a ^ __ac_WY_P1, b ^ h));
+}
+
+UNUSED static kh_inline khint_t __ac_wyhash(const void *buf, size_t len, khint64_t seed)
+{
+	return __ac_fold64(__ac_wyhash64(buf, len, seed));
+}
+
+/*! @function
+  @abstract     Strong integer hash function
+  @param  key   The integer [khint32_t or khint64_t]
+  @return       The hash value [khint_t]
+ */
+#define kh_int_mix_hash_func(key) __ac_fold64(__ac_wymix((khint64_t)(key) ^ __ac_WY_P0, __ac_WY_P1))
+/*! @function
+  @abstract     Strong 64-bit integer hash function (alias of kh_int_mix_hash_func)
+ */
+#define kh_int64_mix_hash_func(key) kh_int_mix_hash_func(key)
+/*! @function
+  @abstract     Seeded integer hash function (for KHASH_INIT_SEEDED)
+  @param  key   The integer [khint32_t or khint64_t]
+  @param  seed  The per-table seed [khint_t]
+  @return       The hash value [khint_t]
+ */
+#define kh_int_seed_hash_func(key, seed)								\
+	__ac_fold64(__ac_wymix((khint64_t)(key) ^ __ac_WY_P0, __ac_WY_P1 ^ ((khint64_t)(seed) * __ac_WY_P2)))
+/*! @function
+  @abstract     Strong const char* hash function
+  @param  key   Pointer to a null terminated string [const char*]
+  @return       The hash value [khint_t]
+ */
+#define kh_str_wy_hash_func(key) __ac_wyhash((key), strlen(key), 0)
+/*! @function
+  @abstract     Seeded const char* hash function (for KHASH_INIT_SEEDED)
+ */
+#define kh_str_seed_hash_func(key, seed) __ac_wyhash((key), strlen(key), (seed))
+/*! @function
+  @abstract     128-bit value hash function with a 64-bit result
+  @param  hi    The high 64 bits [khint64_t]
+  @param  lo    The low 64 bits [khint64_t]
+  @param  seed  Value mixed into the hash (e.g., a type tag or seed) [khint64_t]
+  @return       The hash value [khint64_t]
+ */
+#define kh_u128_hash64(hi, lo, seed)									\
+	__ac_wymix(__ac_wymix((khint64_t)(hi) ^ __ac_WY_P0, (khint64_t)(lo) ^ __ac_WY_P1) ^ (khint64_t)(seed), __ac_WY_P2)
+/*! @function
+  @abstract     128-bit value hash function
+  @param  hi    The high 64 bits [khint64_t]
+  @param  lo    The low 64 bits [khint64_t]
+  @return       The hash value [khint_t]
+ */
+#define kh_u128_hash_func(hi, lo) __ac_fold64(kh_u128_hash64(hi, lo, 0))
 
 /* --- END OF HASH FUNCTIONS --- */
 
@@ -465,6 +1194,14 @@ UNUSED static kh_inline khint_t __ac_Wang_hash(khint_t key)
  */
 #define kh_init(name) kh_init_##name()
 
+/*! @function
+  @abstract     Initiate a hash table with the given hash seed.
+  @param  name  Name of the hash table [symbol]
+  @param  s     Seed passed to the hash function of KHASH_INIT_SEEDED tables [khint_t]
+  @return       Pointer to the hash table [khash_t(name)*]
+ */
+#define kh_init_seed(name, s) kh_init_seed_##name(s)
+
 /*! @function
   @abstract     Destroy a hash table.
   @param  name  Name of the hash table [symbol]
@@ -487,6 +1224,34 @@ UNUSED static kh_inline khint_t __ac_Wang_hash(khint_t key)
  */
 #define kh_resize(name, h, s) kh_resize_##name(h, s)
 
+/*! @function
+  @abstract     Rehash a hash table in place to purge "deleted" markers.
+  @param  name  Name of the hash table [symbol]
+  @param  h     Pointer to the hash table [khash_t(name)*]
+  @return       0 if successful, -1 otherwise [int]
+  @discussion   Not needed for KHASH_INIT_LINEAR tables, which never contain
+                deleted markers.
+ */
+#define kh_compact(name, h) kh_resize_##name(h, kh_n_buckets(h))
+
+/*! @function
+  @abstract     Migrate up to n buckets of an in-progress incremental resize.
+  @param  name  Name of the hash table [symbol]
+  @param  h     Pointer to the hash table [khash_t(name)*]
+  @param  n     Maximum number of old buckets to migrate [khint_t]
+  @discussion   Only available for KHASH_INIT_INCREMENTAL tables.
+ */
+#define kh_rehash_step(name, h, n) kh_rehash_step_##name(h, n)
+
+/*! @function
+  @abstract     Complete an in-progress incremental resize.
+  @param  name  Name of the hash table [symbol]
+  @param  h     Pointer to the hash table [khash_t(name)*]
+  @discussion   Only available for KHASH_INIT_INCREMENTAL tables. Must be
+                called before iterating over the table.
+ */
+#define kh_rehash_finish(name, h) kh_rehash_finish_##name(h)
+
 /*! @function
   @abstract     Insert a key to the hash table.
   @param  name  Name of the hash table [symbol]
@@ -509,6 +1274,47 @@ UNUSED static kh_inline khint_t __ac_Wang_hash(khint_t key)
  */
 #define kh_get(name, h, k) kh_get_##name(h, k)
 
+/*! @function
+  @abstract     Retrieve a batch of keys from the hash table.
+  @param  name  Name of the hash table [symbol]
+  @param  h     Pointer to the hash table [khash_t(name)*]
+  @param  k     Array of keys [const type of keys*]
+  @param  n     Number of keys [khint_t]
+  @param  o     Array of n iterators to fill, each set as kh_get() would [khint_t*]
+  @discussion   All hashes of a group of KH_BATCH_SIZE keys are computed and
+                their buckets prefetched before any probe is resolved, so that
+                memory latency overlaps across keys.
+ */
+#define kh_get_batch(name, h, k, n, o) kh_get_batch_##name(h, k, n, o)
+
+/*! @function
+  @abstract     Insert a batch of keys into the hash table.
+  @param  name  Name of the hash table [symbol]
+  @param  h     Pointer to the hash table [khash_t(name)*]
+  @param  k     Array of keys [const type of keys*]
+  @param  n     Number of keys [khint_t]
+  @param  o     Array of n iterators to fill, each set as kh_put() would [khint_t*]
+  @param  r     Array of n return codes as for kh_put(), or NULL [int*]
+  @return       0 if successful, -1 if the table could not be resized (in which
+                case no key was inserted) [int]
+  @discussion   The table is resized up front if needed, so all iterators
+                returned in o remain valid when the call returns.
+ */
+#define kh_put_batch(name, h, k, n, o, r) kh_put_batch_##name(h, k, n, o, r)
+
+/*! @function
+  @abstract     Gather statistics about a hash table.
+  @param  name  Name of the hash table [symbol]
+  @param  h     Pointer to the hash table [khash_t(name)*]
+  @param  s     Statistics to fill [kh_stats_t*]
+  @discussion   Probe lengths are measured by walking the whole table, so this
+                costs about as much as a lookup of every key; nothing is
+                counted on the lookup path. Resize counters are only kept
+                when KHASH_STATS is defined, and are 0 otherwise. Not
+                available for KHASH_INIT_INCREMENTAL tables.
+ */
+#define kh_stats(name, h, s) kh_stats_##name(h, s)
+
 /*! @function
   @abstract     Remove a key from the hash table.
   @param  name  Name of the hash table [symbol]
@@ -531,7 +1337,11 @@ UNUSED static kh_inline khint_t __ac_Wang_hash(khint_t key)
   @param  x     Iterator to the bucket [khint_t]
   @return       Key [type of keys]
  */
+#if __GNUC__ >= 3
+#define kh_key(h, x) __kh_elem(h, keys, __kh_kstride(h), x)
+#else
 #define kh_key(h, x) ((h)->keys[x])
+#endif
 
 /*! @function
   @abstract     Get value given an iterator
@@ -540,12 +1350,16 @@ UNUSED static kh_inline khint_t __ac_Wang_hash(khint_t key)
   @return       Value [type of values]
   @discussion   For hash sets, calling this results in segfault.
  */
+#if __GNUC__ >= 3
+#define kh_val(h, x) __kh_elem(h, vals, __kh_vstride(h), x)
+#else
 #define kh_val(h, x) ((h)->vals[x])
+#endif
 
 /*! @function
   @abstract     Alias of kh_val()
  */
-#define kh_value(h, x) ((h)->vals[x])
+#define kh_value(h, x) kh_val(h, x)
 
 /*! @function
   @abstract     Get the start iterator
@@ -639,6 +1453,40 @@ UNUSED static kh_inline khint_t __ac_Wang_hash(khint_t key)
 #define KHASH_MAP_INIT_INT64(name, khval_t)								\
 	KHASH_INIT(name, khint64_t, khval_t, 1, kh_int64_hash_func, kh_int64_hash_equal)
 
+/*! @function
+  @abstract     Instantiate a hash set containing integer keys, hashed with
+                kh_int_mix_hash_func
+  @param  name  Name of the hash table [symbol]
+ */
+#define KHASH_SET_INIT_INT_MIX(name)									\
+	KHASH_INIT(name, khint32_t, char, 0, kh_int_mix_hash_func, kh_int_hash_equal)
+
+/*! @function
+  @abstract     Instantiate a hash map containing integer keys, hashed with
+                kh_int_mix_hash_func
+  @param  name  Name of the hash table [symbol]
+  @param  khval_t  Type of values [type]
+ */
+#define KHASH_MAP_INIT_INT_MIX(name, khval_t)							\
+	KHASH_INIT(name, khint32_t, khval_t, 1, kh_int_mix_hash_func, kh_int_hash_equal)
+
+/*! @function
+  @abstract     Instantiate a hash set containing 64-bit integer keys, hashed
+                with kh_int64_mix_hash_func
+  @param  name  Name of the hash table [symbol]
+ */
+#define KHASH_SET_INIT_INT64_MIX(name)									\
+	KHASH_INIT(name, khint64_t, char, 0, kh_int64_mix_hash_func, kh_int64_hash_equal)
+
+/*! @function
+  @abstract     Instantiate a hash map containing 64-bit integer keys, hashed
+                with kh_int64_mix_hash_func
+  @param  name  Name of the hash table [symbol]
+  @param  khval_t  Type of values [type]
+ */
+#define KHASH_MAP_INIT_INT64_MIX(name, khval_t)							\
+	KHASH_INIT(name, khint64_t, khval_t, 1, kh_int64_mix_hash_func, kh_int64_hash_equal)
+
 typedef const char *kh_cstr_t;
 /*! @function
   @abstract     Instantiate a hash map containing const char* keys
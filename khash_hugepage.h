@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2026 The Regents of the University of California.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __KHASH_HUGEPAGE_H
+#define __KHASH_HUGEPAGE_H
+
+#include "khash.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+/** @file
+ *
+ * @brief An allocator for KHASH_INIT_ALLOC that backs large bucket arrays with
+ * anonymous memory mappings aligned to, and advised to use, transparent huge
+ * pages. For multi-GB tables this replaces millions of 4KB TLB entries with a
+ * few thousand 2MB ones. Arrays smaller than KH_HUGEPAGE_MIN are left to
+ * malloc.
+ *
+ * Mappings are created lazily by the kernel, so pages of a large table are
+ * placed on the NUMA node of the thread that first writes to them.
+ *
+ */
+
+/*
+  Example usage.
+
+#include "khash_hugepage.h"
+
+KHASH_INIT_ALLOC(flows, uint64_t, flow_t, 1, kh_int64_hash_func,
+                 kh_int64_hash_equal, kh_hugepage)
+*/
+
+/** Size of a transparent huge page */
+#ifndef KH_HUGEPAGE_SIZE
+#define KH_HUGEPAGE_SIZE ((size_t)2 << 20)
+#endif
+
+/** Arrays of at least this many bytes are mapped rather than malloc'd */
+#ifndef KH_HUGEPAGE_MIN
+#define KH_HUGEPAGE_MIN KH_HUGEPAGE_SIZE
+#endif
+
+#define __kh_hp_len(size)                                               \
+  (((size) + KH_HUGEPAGE_SIZE - 1) & ~(KH_HUGEPAGE_SIZE - 1))
+
+/** Map len bytes (a multiple of KH_HUGEPAGE_SIZE) aligned to a huge page */
+static inline void *__kh_hp_map(size_t len)
+{
+  char *p, *aligned;
+  size_t head;
+  /* over-map by one huge page and trim both ends to the alignment */
+  p = mmap(NULL, len + KH_HUGEPAGE_SIZE, PROT_READ | PROT_WRITE,
+           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) {
+    return NULL;
+  }
+  aligned = (char *)(((uintptr_t)p + KH_HUGEPAGE_SIZE - 1) &
+                     ~(uintptr_t)(KH_HUGEPAGE_SIZE - 1));
+  head = aligned - p;
+  if (head != 0) {
+    munmap(p, head);
+  }
+  munmap(aligned + len, KH_HUGEPAGE_SIZE - head);
+#ifdef MADV_HUGEPAGE
+  madvise(aligned, len, MADV_HUGEPAGE);
+#endif
+  return aligned;
+}
+
+static inline void *kh_hugepage_alloc(size_t size)
+{
+  if (size < KH_HUGEPAGE_MIN) {
+    return kmalloc(size);
+  }
+  return __kh_hp_map(__kh_hp_len(size));
+}
+
+static inline void kh_hugepage_free(void *ptr, size_t size)
+{
+  if (ptr == NULL) {
+    return;
+  }
+  if (size < KH_HUGEPAGE_MIN) {
+    kfree(ptr);
+  } else {
+    munmap(ptr, __kh_hp_len(size));
+  }
+}
+
+static inline void *kh_hugepage_realloc(void *ptr, size_t old_size,
+                                        size_t size)
+{
+  void *p;
+  if (ptr == NULL) {
+    return kh_hugepage_alloc(size);
+  }
+  if (old_size < KH_HUGEPAGE_MIN && size < KH_HUGEPAGE_MIN) {
+    return krealloc(ptr, size);
+  }
+  if (old_size >= KH_HUGEPAGE_MIN && size >= KH_HUGEPAGE_MIN) {
+    if (__kh_hp_len(old_size) == __kh_hp_len(size)) {
+      return ptr;
+    }
+    if (size < old_size) {
+      /* shrinking never moves the mapping */
+      munmap((char *)ptr + __kh_hp_len(size),
+             __kh_hp_len(old_size) - __kh_hp_len(size));
+      return ptr;
+    }
+  }
+  /* moving between malloc and a mapping, or growing a mapping */
+  if ((p = kh_hugepage_alloc(size)) == NULL) {
+    return NULL;
+  }
+  memcpy(p, ptr, old_size < size ? old_size : size);
+  kh_hugepage_free(ptr, old_size);
+  return p;
+}
+
+#endif /* __KHASH_HUGEPAGE_H */
@@ -0,0 +1,369 @@
+/*
+ * Copyright (C) 2026 The Regents of the University of California.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __KHASH_MMAP_H
+#define __KHASH_MMAP_H
+
+#include "khash.h"
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/** @file
+ *
+ * @brief Persistent snapshots of khash tables. A table is written to a file
+ * as a small header followed by the raw flags, keys and vals arrays, each
+ * aligned to a page boundary. The file can then be mapped read-only and used
+ * directly with kh_get, kh_exist, kh_key, kh_val and kh_foreach, without any
+ * parsing or rehashing.
+ *
+ * Tables with separate or combined (KHASH_INIT_KV) key/value arrays are
+ * supported. Only tables whose keys and values are plain data (i.e., contain
+ * no pointers) can be saved, and the hash function must give the same result in
+ * every process (seeded tables are fine, the seed is saved with the table).
+ * Snapshots are not portable between architectures with different endianness
+ * or type sizes; this is checked when the file is mapped.
+ *
+ */
+
+/*
+  Example usage.
+
+#include "khash_mmap.h"
+
+KHASH_MAP_INIT_INT(ip2asn, uint32_t)
+KHASH_MMAP_INIT(ip2asn, khint32_t, uint32_t, 1)
+
+// in the producer:
+khash_t(ip2asn) *h = kh_init(ip2asn);
+// ... fill the table ...
+if (kh_save(ip2asn, h, "ip2asn.khs") != 0) {
+  // handle error
+}
+
+// in each consumer:
+const khash_t(ip2asn) *m = kh_mmap(ip2asn, "ip2asn.khs");
+khiter_t k = kh_get(ip2asn, m, addr);
+if (k != kh_end(m)) {
+  asn = kh_val(m, k);
+}
+kh_munmap(ip2asn, m);
+*/
+
+/* prevent warnings for unused, macro-generated functions */
+#if __GNUC__ >= 3
+#  ifndef UNUSED
+#    define UNUSED  __attribute__((unused))
+#  endif
+#else
+#  ifndef UNUSED
+#    define UNUSED
+#  endif
+#endif
+
+/** Magic bytes at the start of every snapshot file */
+#define KHMM_MAGIC "KHSNAP\r\n"
+
+/** Snapshot format version */
+#define KHMM_VERSION 1
+
+/** Alignment of the arrays within the snapshot file */
+#define KHMM_ALIGN 4096
+
+/** Snapshot file header */
+typedef struct khmm_header {
+  /** KHMM_MAGIC */
+  char magic[8];
+  /** KHMM_VERSION */
+  uint32_t version;
+  /** Value 0x01020304, to detect endianness mismatches */
+  uint32_t byte_order;
+  /** sizeof(khint_t), and the distance between consecutive keys and values
+   * (val_size is 0 for sets) */
+  uint32_t khint_size, key_size, val_size;
+  /** 0 if keys and values are stored in separate arrays, 1 if they are
+   * interleaved (KHASH_INIT_KV), in which case vals_off points into the keys
+   * array */
+  uint32_t combined;
+  /** Table header */
+  uint64_t n_buckets, size, n_occupied, upper_bound, seed;
+  /** Offsets of the arrays from the start of the file */
+  uint64_t flags_off, keys_off, vals_off;
+  /** Total size of the file */
+  uint64_t file_size;
+} khmm_header_t;
+
+#define __khmm_align(x) (((x) + KHMM_ALIGN - 1) & ~(uint64_t)(KHMM_ALIGN - 1))
+
+/** Write len bytes (followed by zero padding up to the next KHMM_ALIGN
+ * boundary if pad is set) to the given file. Returns 0 on success. */
+UNUSED static inline int __khmm_write(FILE *fp, const void *buf, size_t len,
+                                      int pad)
+{
+  static const char zeros[KHMM_ALIGN];
+  if (len != 0 && fwrite(buf, 1, len, fp) != len) {
+    return -1;
+  }
+  if (pad && (len % KHMM_ALIGN) != 0 &&
+      fwrite(zeros, 1, KHMM_ALIGN - (len % KHMM_ALIGN), fp) !=
+        KHMM_ALIGN - (len % KHMM_ALIGN)) {
+    return -1;
+  }
+  return 0;
+}
+
+/** Create a temporary file next to path (path followed by ".XXXXXX") and
+ * open it for writing. On success, *tmp receives the temporary path, which
+ * must be passed to __khmm_commit. */
+UNUSED static inline FILE *__khmm_open_tmp(const char *path, char **tmp)
+{
+  size_t len = strlen(path);
+  FILE *fp;
+  int fd;
+  if ((*tmp = malloc(len + sizeof(".XXXXXX"))) == NULL) {
+    return NULL;
+  }
+  memcpy(*tmp, path, len);
+  memcpy(*tmp + len, ".XXXXXX", sizeof(".XXXXXX"));
+  if ((fd = mkstemp(*tmp)) < 0) {
+    free(*tmp);
+    return NULL;
+  }
+  /* mkstemp creates the file as 0600, but consumers may run as other users */
+  if (fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH) != 0 ||
+      (fp = fdopen(fd, "wb")) == NULL) {
+    close(fd);
+    unlink(*tmp);
+    free(*tmp);
+    return NULL;
+  }
+  return fp;
+}
+
+/** Close a file opened by __khmm_open_tmp. If ret is 0 and the data reaches
+ * the disk, the temporary file atomically replaces path, otherwise it is
+ * removed. Returns 0 on success. */
+UNUSED static inline int __khmm_commit(FILE *fp, char *tmp, const char *path,
+                                       int ret)
+{
+  if (ret == 0 && (fflush(fp) != 0 || fsync(fileno(fp)) != 0)) {
+    ret = -1;
+  }
+  if (fclose(fp) != 0) {
+    ret = -1;
+  }
+  if (ret == 0 && rename(tmp, path) != 0) {
+    ret = -1;
+  }
+  if (ret != 0) {
+    unlink(tmp);
+  }
+  free(tmp);
+  return ret;
+}
+
+/** Check that an array of n elements of the given size, starting at off,
+ * ends at or before limit (without overflowing) */
+UNUSED static inline int __khmm_fits(uint64_t off, uint64_t n, uint64_t size,
+                                     uint64_t limit)
+{
+  return off <= limit && (size == 0 || n <= (limit - off) / size);
+}
+
+#define __KHASH_MMAP_TYPES(name)                                        \
+  typedef struct {                                                      \
+    kh_##name##_t h; /* must be first */                                \
+    void *base;                                                         \
+    size_t len;                                                         \
+  } khmm_##name##_t;
+
+#define __KHASH_MMAP_IMPL(name, SCOPE, khkey_t, khval_t, kh_is_map)     \
+  SCOPE int kh_save_##name(const kh_##name##_t *h, const char *path)    \
+  {                                                                     \
+    khmm_header_t hdr;                                                  \
+    uint64_t flags_len, keys_len, vals_len;                             \
+    FILE *fp;                                                           \
+    char *tmp;                                                          \
+    int combined = __kh_kstride(h) != sizeof(khkey_t);                  \
+    int ret = 0;                                                        \
+    memset(&hdr, 0, sizeof(hdr));                                       \
+    memcpy(hdr.magic, KHMM_MAGIC, sizeof(hdr.magic));                   \
+    hdr.version = KHMM_VERSION;                                         \
+    hdr.byte_order = 0x01020304;                                        \
+    hdr.khint_size = sizeof(khint_t);                                   \
+    hdr.key_size = __kh_kstride(h);                                     \
+    hdr.val_size = kh_is_map ? __kh_vstride(h) : 0;                     \
+    hdr.combined = combined;                                            \
+    hdr.n_buckets = h->n_buckets;                                       \
+    hdr.size = h->size;                                                 \
+    hdr.n_occupied = h->n_occupied;                                     \
+    hdr.upper_bound = h->upper_bound;                                   \
+    hdr.seed = h->seed;                                                 \
+    flags_len = h->n_buckets ? __ac_fsize(h->n_buckets) * sizeof(khint32_t) : 0; \
+    keys_len = (uint64_t)h->n_buckets * hdr.key_size;                   \
+    vals_len = combined ? 0 : (uint64_t)h->n_buckets * hdr.val_size;    \
+    hdr.flags_off = __khmm_align(sizeof(hdr));                          \
+    hdr.keys_off = hdr.flags_off + __khmm_align(flags_len);             \
+    hdr.vals_off = hdr.keys_off + __khmm_align(keys_len);               \
+    hdr.file_size = hdr.vals_off + __khmm_align(vals_len);              \
+    if (combined && h->n_buckets) {                                     \
+      hdr.vals_off = hdr.keys_off + (uint64_t)((char *)h->vals - (char *)h->keys); \
+    }                                                                   \
+    /* write to a temporary file and rename it over path, so that readers \
+       never see a partially written snapshot */                        \
+    if ((fp = __khmm_open_tmp(path, &tmp)) == NULL) {                   \
+      return -1;                                                        \
+    }                                                                   \
+    if (__khmm_write(fp, &hdr, sizeof(hdr), 1) != 0 ||                  \
+        __khmm_write(fp, h->flags, flags_len, 1) != 0 ||                \
+        __khmm_write(fp, h->keys, keys_len, 1) != 0 ||                  \
+        (kh_is_map && !combined &&                                      \
+         __khmm_write(fp, h->vals, vals_len, 1) != 0)) {                \
+      ret = -1;                                                         \
+    }                                                                   \
+    return __khmm_commit(fp, tmp, path, ret);                           \
+  }                                                                     \
+  SCOPE const kh_##name##_t *kh_mmap_##name(const char *path)           \
+  {                                                                     \
+    khmm_##name##_t *m;                                                 \
+    const khmm_header_t *hdr;                                           \
+    struct stat st;                                                     \
+    void *base;                                                         \
+    int fd;                                                             \
+    if ((fd = open(path, O_RDONLY)) < 0) {                              \
+      return NULL;                                                      \
+    }                                                                   \
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(*hdr)) {     \
+      close(fd);                                                        \
+      return NULL;                                                      \
+    }                                                                   \
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);        \
+    close(fd);                                                          \
+    if (base == MAP_FAILED) {                                           \
+      return NULL;                                                      \
+    }                                                                   \
+    hdr = base;                                                         \
+    /* make sure the snapshot is compatible with this table, and that every \
+       array lies within the file */                                    \
+    if (memcmp(hdr->magic, KHMM_MAGIC, sizeof(hdr->magic)) != 0 ||      \
+        hdr->version != KHMM_VERSION || hdr->byte_order != 0x01020304 || \
+        hdr->khint_size != sizeof(khint_t) ||                           \
+        hdr->key_size != __kh_kstride(&m->h) ||                         \
+        hdr->val_size != (kh_is_map ? __kh_vstride(&m->h) : 0) ||       \
+        hdr->combined != (__kh_kstride(&m->h) != sizeof(khkey_t)) ||    \
+        hdr->file_size != (uint64_t)st.st_size ||                       \
+        hdr->n_buckets > (khint_t)-1 ||                                 \
+        (hdr->n_buckets & (hdr->n_buckets - 1)) != 0 ||                 \
+        !__khmm_fits(hdr->flags_off,                                    \
+                     hdr->n_buckets ? __ac_fsize(hdr->n_buckets) : 0,   \
+                     sizeof(khint32_t), hdr->keys_off) ||               \
+        (!hdr->combined &&                                              \
+         (!__khmm_fits(hdr->keys_off, hdr->n_buckets, hdr->key_size,    \
+                       hdr->vals_off) ||                                \
+          !__khmm_fits(hdr->vals_off, hdr->n_buckets, hdr->val_size,    \
+                       hdr->file_size))) ||                             \
+        (hdr->combined &&                                               \
+         (!__khmm_fits(hdr->keys_off, hdr->n_buckets, hdr->key_size,    \
+                       hdr->file_size) ||                               \
+          (hdr->n_buckets && (hdr->vals_off < hdr->keys_off ||          \
+                              hdr->vals_off >= hdr->keys_off + hdr->key_size)))) || \
+        (m = calloc(1, sizeof(khmm_##name##_t))) == NULL) {             \
+      munmap(base, st.st_size);                                         \
+      return NULL;                                                      \
+    }                                                                   \
+    m->base = base;                                                     \
+    m->len = st.st_size;                                                \
+    m->h.n_buckets = hdr->n_buckets;                                    \
+    m->h.size = hdr->size;                                              \
+    m->h.n_occupied = hdr->n_occupied;                                  \
+    m->h.upper_bound = hdr->upper_bound;                                \
+    m->h.seed = hdr->seed;                                              \
+    m->h.flags = (khint32_t *)((char *)base + hdr->flags_off);          \
+    m->h.keys = (khkey_t *)((char *)base + hdr->keys_off);              \
+    m->h.vals = kh_is_map ? (khval_t *)((char *)base + hdr->vals_off) : NULL; \
+    return &m->h;                                                       \
+  }                                                                     \
+  SCOPE void kh_munmap_##name(const kh_##name##_t *h)                   \
+  {                                                                     \
+    khmm_##name##_t *m = (khmm_##name##_t *)h;                          \
+    if (m == NULL) { return; }                                          \
+    munmap(m->base, m->len);                                            \
+    free(m);                                                            \
+  }
+
+/** Instantiate snapshot support for an existing khash instantiation
+ *
+ * @param name          Name of the khash table (as passed to KHASH_INIT)
+ * @param khkey_t       Type of keys
+ * @param khval_t       Type of values
+ * @param kh_is_map     1 if the table is a map, 0 if it is a set
+ */
+#define KHASH_MMAP_INIT(name, khkey_t, khval_t, kh_is_map)              \
+  __KHASH_MMAP_TYPES(name)                                              \
+  __KHASH_MMAP_IMPL(name, UNUSED static kh_inline, khkey_t, khval_t, kh_is_map)
+
+/** Convenience macros */
+
+/** Save a table to a snapshot file
+ *
+ * @param name          Name of the table [symbol]
+ * @param h             Pointer to the table to save [khash_t(name)*]
+ * @param path          Path of the file to write (will be overwritten)
+ * @return 0 if the snapshot was written successfully, -1 otherwise
+ *
+ * The snapshot is written to a temporary file in the same directory, synced
+ * to disk and then renamed over path, so a reader (or a crash) never sees a
+ * partially written file, and tables already mapped from the old file remain
+ * valid. On failure, path is left untouched.
+ */
+#define kh_save(name, h, path) kh_save_##name(h, path)
+
+/** Map a snapshot file as a read-only table
+ *
+ * @param name          Name of the table [symbol]
+ * @param path          Path of the snapshot file
+ * @return pointer to a read-only table, or NULL if the file could not be
+ * mapped or is not a compatible snapshot [const khash_t(name)*]
+ *
+ * The returned table must only be used with functions that do not modify it
+ * (e.g., kh_get, kh_exist, kh_key, kh_val, kh_foreach) and must be released
+ * with kh_munmap, never kh_destroy.
+ */
+#define kh_mmap(name, path) kh_mmap_##name(path)
+
+/** Release a table returned by kh_mmap
+ *
+ * @param name          Name of the table [symbol]
+ * @param h             Pointer to the mapped table [const khash_t(name)*]
+ */
+#define kh_munmap(name, h) kh_munmap_##name(h)
+
+#endif /* __KHASH_MMAP_H */
@@ -0,0 +1,497 @@
+/*
+ * Copyright (C) 2026 The Regents of the University of California.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __KHASH_SHARD_H
+#define __KHASH_SHARD_H
+
+#include "config.h"
+#ifdef HAVE_PTHREAD
+
+#include "khash.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/** @file
+ *
+ * @brief A sharded, thread-safe hash map built on top of khash. The key space
+ * is split over 2^shard_bits independent khash tables, each protected by its
+ * own mutex, so that threads working on different keys rarely contend.
+ *
+ * Also provides a parallel fold of (per-thread) khash tables into a sharded
+ * map. The folding threads first split the source buckets between them,
+ * hashing each key once to find its shard, and then each one merges the keys
+ * of a disjoint subset of the shards, so no locking is needed while folding.
+ *
+ */
+
+/*
+  Example usage.
+  Per-thread counters folded into a single sharded map at interval end.
+
+#include "khash_shard.h"
+
+KHASH_INIT(cnt, uint32_t, uint64_t, 1, kh_int_hash_func, kh_int_hash_equal)
+KHASH_SHARD_INIT(cnt, uint32_t, uint64_t, 1, kh_int_hash_func, 6)
+
+static void sum(uint64_t *dst, uint64_t src)
+{
+  *dst += src;
+}
+
+int main(int argc, char **argv)
+{
+  khash_t(cnt) *per_thread[4]; // filled by worker threads
+  khs_t(cnt) *s = khs_init(cnt);
+
+  // either update concurrently from many threads:
+  khs_upsert(cnt, s, 1234, 1, sum);
+
+  // or fold all the per-thread tables using 4 threads:
+  khs_fold(cnt, s, per_thread, 4, 4, sum);
+
+  khs_destroy(cnt, s);
+  return 0;
+}
+*/
+
+/* prevent warnings for unused, macro-generated functions */
+#if __GNUC__ >= 3
+#  ifndef UNUSED
+#    define UNUSED  __attribute__((unused))
+#  endif
+#else
+#  ifndef UNUSED
+#    define UNUSED
+#  endif
+#endif
+
+/** Size of a cache line. Shards are padded to this to avoid false sharing */
+#ifndef KHS_CACHELINE
+#define KHS_CACHELINE 64
+#endif
+
+/** Map a hash value to a shard index (Fibonacci hashing).
+ *
+ * The high bits of the product are used so that shard selection is
+ * independent of the low bits that khash uses to index within the shard.
+ */
+#define __khs_shard_of(hash, shard_bits)                                \
+  ((shard_bits) == 0 ? 0 :                                              \
+   (khint_t)(((khint32_t)(hash) * 0x9E3779B1u) >> (32 - (shard_bits))))
+
+#define __KHASH_SHARD_TYPES(name, khkey_t, khval_t)                     \
+  typedef struct {                                                      \
+    pthread_mutex_t lock;                                               \
+    kh_##name##_t *h;                                                   \
+  } __attribute__((aligned(KHS_CACHELINE))) khs_##name##_shard_t;       \
+  typedef struct {                                                      \
+    khs_##name##_shard_t *shards;                                       \
+    khint_t n_shards;                                                   \
+  } khs_##name##_t;                                                     \
+  typedef void (*khs_##name##_merge_f)(khval_t *dst, khval_t src);      \
+  /* a source bucket, and the shard its key belongs to */               \
+  typedef struct {                                                      \
+    khint_t k;                                                          \
+    khint_t shard;                                                      \
+    int src;                                                            \
+  } __khs_##name##_ent_t;                                               \
+  typedef struct {                                                      \
+    __khs_##name##_ent_t *ents;                                         \
+    size_t n, m;                                                        \
+  } __khs_##name##_ents_t;                                              \
+  typedef struct __khs_##name##_fold_arg {                              \
+    khs_##name##_t *s;                                                  \
+    kh_##name##_t **srcs;                                               \
+    int n_srcs;                                                         \
+    int n_threads;                                                      \
+    int tid;                                                            \
+    khs_##name##_merge_f merge_f;                                       \
+    /* range of source buckets (over all sources) split by this thread */ \
+    uint64_t from, to;                                                  \
+    /* entries found by this thread, one list per merging thread */     \
+    __khs_##name##_ents_t *out;                                         \
+    struct __khs_##name##_fold_arg *all;                                \
+    int ret;                                                            \
+  } __khs_##name##_fold_arg_t;
+
+#define __KHASH_SHARD_IMPL(name, SCOPE, khkey_t, khval_t, kh_is_map,    \
+                           __hash_func, shard_bits)                     \
+  SCOPE khint_t khs_shard_##name(khkey_t key)                           \
+  {                                                                     \
+    return __khs_shard_of(__hash_func(key), shard_bits);                \
+  }                                                                     \
+  SCOPE void khs_destroy_##name(khs_##name##_t *s)                      \
+  {                                                                     \
+    khint_t i;                                                          \
+    if (s == NULL) { return; }                                          \
+    if (s->shards != NULL) {                                            \
+      for (i = 0; i < s->n_shards; i++) {                               \
+        if (s->shards[i].h != NULL) {                                   \
+          kh_destroy_##name(s->shards[i].h);                            \
+          pthread_mutex_destroy(&s->shards[i].lock);                    \
+        }                                                               \
+      }                                                                 \
+      free(s->shards);                                                  \
+    }                                                                   \
+    free(s);                                                            \
+  }                                                                     \
+  SCOPE khs_##name##_t *khs_init_##name(void)                           \
+  {                                                                     \
+    khs_##name##_t *s;                                                  \
+    void *mem;                                                          \
+    khint_t i;                                                          \
+    if ((s = calloc(1, sizeof(khs_##name##_t))) == NULL) {              \
+      return NULL;                                                      \
+    }                                                                   \
+    s->n_shards = (khint_t)1 << (shard_bits);                           \
+    if (posix_memalign(&mem, KHS_CACHELINE,                             \
+                       sizeof(khs_##name##_shard_t) * s->n_shards) != 0) { \
+      free(s);                                                          \
+      return NULL;                                                      \
+    }                                                                   \
+    s->shards = mem;                                                    \
+    memset(s->shards, 0, sizeof(khs_##name##_shard_t) * s->n_shards);   \
+    for (i = 0; i < s->n_shards; i++) {                                 \
+      if ((s->shards[i].h = kh_init_##name()) == NULL) {                \
+        khs_destroy_##name(s);                                          \
+        return NULL;                                                    \
+      }                                                                 \
+      pthread_mutex_init(&s->shards[i].lock, NULL);                     \
+    }                                                                   \
+    return s;                                                           \
+  }                                                                     \
+  SCOPE kh_##name##_t *khs_lock_##name(khs_##name##_t *s, khkey_t key)  \
+  {                                                                     \
+    khs_##name##_shard_t *sh = &s->shards[khs_shard_##name(key)];       \
+    pthread_mutex_lock(&sh->lock);                                      \
+    return sh->h;                                                       \
+  }                                                                     \
+  SCOPE void khs_unlock_##name(khs_##name##_t *s, khkey_t key)          \
+  {                                                                     \
+    pthread_mutex_unlock(&s->shards[khs_shard_##name(key)].lock);       \
+  }                                                                     \
+  SCOPE khint_t khs_size_##name(khs_##name##_t *s)                      \
+  {                                                                     \
+    khint_t i, size = 0;                                                \
+    for (i = 0; i < s->n_shards; i++) {                                 \
+      pthread_mutex_lock(&s->shards[i].lock);                           \
+      size += kh_size(s->shards[i].h);                                  \
+      pthread_mutex_unlock(&s->shards[i].lock);                         \
+    }                                                                   \
+    return size;                                                        \
+  }                                                                     \
+  SCOPE int __khs_merge_one_##name(kh_##name##_t *dst, khkey_t key,     \
+                                   khval_t *val,                        \
+                                   khs_##name##_merge_f merge_f)        \
+  {                                                                     \
+    int ret;                                                            \
+    khint_t k = kh_put_##name(dst, key, &ret);                          \
+    if (ret < 0) {                                                      \
+      return -1;                                                        \
+    }                                                                   \
+    if (kh_is_map) {                                                    \
+      if (ret == 0 && merge_f != NULL) {                                \
+        merge_f(&kh_val(dst, k), *val);                                 \
+      } else {                                                          \
+        kh_val(dst, k) = *val;                                          \
+      }                                                                 \
+    }                                                                   \
+    return ret;                                                         \
+  }                                                                     \
+  SCOPE int khs_upsert_##name(khs_##name##_t *s, khkey_t key,           \
+                              khval_t val, khs_##name##_merge_f merge_f) \
+  {                                                                     \
+    khs_##name##_shard_t *sh = &s->shards[khs_shard_##name(key)];       \
+    int ret;                                                            \
+    pthread_mutex_lock(&sh->lock);                                      \
+    ret = __khs_merge_one_##name(sh->h, key, &val, merge_f);            \
+    pthread_mutex_unlock(&sh->lock);                                    \
+    return ret;                                                         \
+  }                                                                     \
+  /* phase 1: hash each key in this thread's range of source buckets once, \
+     and hand it to the thread that owns its shard */                   \
+  SCOPE void *__khs_fold_split_##name(void *user)                       \
+  {                                                                     \
+    __khs_##name##_fold_arg_t *arg = user;                              \
+    __khs_##name##_ents_t *l;                                           \
+    __khs_##name##_ent_t *tmp;                                          \
+    kh_##name##_t *src;                                                 \
+    uint64_t base = 0, lo, hi;                                          \
+    khint_t k, shard;                                                   \
+    int i;                                                              \
+    for (i = 0; i < arg->n_srcs && base < arg->to; i++) {               \
+      if ((src = arg->srcs[i]) == NULL) { continue; }                   \
+      lo = arg->from > base ? arg->from - base : 0;                     \
+      hi = arg->to - base < kh_end(src) ? arg->to - base : kh_end(src); \
+      base += kh_end(src);                                              \
+      for (k = (khint_t)lo; k < hi; ++k) {                              \
+        if (!kh_exist(src, k)) { continue; }                            \
+        shard = khs_shard_##name(kh_key(src, k));                       \
+        l = &arg->out[shard % arg->n_threads];                          \
+        if (l->n == l->m) {                                             \
+          l->m = l->m ? l->m << 1 : 256;                                \
+          if ((tmp = realloc(l->ents, sizeof(*tmp) * l->m)) == NULL) {  \
+            arg->ret = -1;                                              \
+            return NULL;                                                \
+          }                                                             \
+          l->ents = tmp;                                                \
+        }                                                               \
+        l->ents[l->n].k = k;                                            \
+        l->ents[l->n].shard = shard;                                    \
+        l->ents[l->n].src = i;                                          \
+        l->n++;                                                         \
+      }                                                                 \
+    }                                                                   \
+    return NULL;                                                        \
+  }                                                                     \
+  /* phase 2: merge the entries for this thread's shards. Lists are taken in \
+     thread order, so values are merged in source order */              \
+  SCOPE void *__khs_fold_merge_##name(void *user)                       \
+  {                                                                     \
+    __khs_##name##_fold_arg_t *arg = user;                              \
+    khs_##name##_t *s = arg->s;                                         \
+    __khs_##name##_ents_t *l;                                           \
+    __khs_##name##_ent_t *e;                                            \
+    kh_##name##_t *src;                                                 \
+    size_t j;                                                           \
+    int t;                                                              \
+    for (t = 0; t < arg->n_threads; t++) {                              \
+      l = &arg->all[t].out[arg->tid];                                   \
+      for (j = 0; j < l->n; j++) {                                      \
+        e = &l->ents[j];                                                \
+        src = arg->srcs[e->src];                                        \
+        /* this thread owns the shard, so no locking needed */          \
+        if (__khs_merge_one_##name(s->shards[e->shard].h, kh_key(src, e->k), \
+                                   kh_is_map ? &kh_val(src, e->k) : NULL, \
+                                   arg->merge_f) < 0) {                 \
+          arg->ret = -1;                                                \
+          return NULL;                                                  \
+        }                                                               \
+      }                                                                 \
+    }                                                                   \
+    return NULL;                                                        \
+  }                                                                     \
+  /* run fn on all args, using the caller as the first thread */        \
+  SCOPE void __khs_fold_run_##name(__khs_##name##_fold_arg_t *args,     \
+                                   pthread_t *threads, int n_threads,   \
+                                   void *(*fn)(void *))                 \
+  {                                                                     \
+    int t, started = 0;                                                 \
+    for (t = 1; t < n_threads; t++) {                                   \
+      if (pthread_create(&threads[t], NULL, fn, &args[t]) != 0) {       \
+        break;                                                          \
+      }                                                                 \
+      started++;                                                        \
+    }                                                                   \
+    /* could not start all threads; run the remaining shares here */    \
+    for (t = started + 1; t < n_threads; t++) {                         \
+      fn(&args[t]);                                                     \
+    }                                                                   \
+    fn(&args[0]);                                                       \
+    for (t = 1; t <= started; t++) {                                    \
+      pthread_join(threads[t], NULL);                                   \
+    }                                                                   \
+  }                                                                     \
+  SCOPE int khs_fold_##name(khs_##name##_t *s, kh_##name##_t **srcs,    \
+                            int n_srcs, int n_threads,                  \
+                            khs_##name##_merge_f merge_f)               \
+  {                                                                     \
+    __khs_##name##_fold_arg_t *args;                                    \
+    __khs_##name##_ents_t *lists;                                       \
+    pthread_t *threads;                                                 \
+    uint64_t n_buckets = 0;                                             \
+    khint_t i;                                                          \
+    int t, ret = 0;                                                     \
+    if (n_threads < 1) { n_threads = 1; }                               \
+    if ((khint_t)n_threads > s->n_shards) { n_threads = s->n_shards; }  \
+    for (t = 0; t < n_srcs; t++) {                                      \
+      if (srcs[t] != NULL) { n_buckets += kh_end(srcs[t]); }            \
+    }                                                                   \
+    args = calloc(n_threads, sizeof(__khs_##name##_fold_arg_t));        \
+    lists = calloc((size_t)n_threads * n_threads,                       \
+                   sizeof(__khs_##name##_ents_t));                      \
+    threads = calloc(n_threads, sizeof(pthread_t));                     \
+    if (args == NULL || lists == NULL || threads == NULL) {             \
+      free(args); free(lists); free(threads);                           \
+      return -1;                                                        \
+    }                                                                   \
+    for (t = 0; t < n_threads; t++) {                                   \
+      args[t].s = s;                                                    \
+      args[t].srcs = srcs;                                              \
+      args[t].n_srcs = n_srcs;                                          \
+      args[t].n_threads = n_threads;                                    \
+      args[t].tid = t;                                                  \
+      args[t].merge_f = merge_f;                                        \
+      args[t].from = n_buckets * t / n_threads;                         \
+      args[t].to = n_buckets * (t + 1) / n_threads;                     \
+      args[t].out = &lists[(size_t)t * n_threads];                      \
+      args[t].all = args;                                               \
+    }                                                                   \
+    __khs_fold_run_##name(args, threads, n_threads, __khs_fold_split_##name); \
+    for (t = 0; t < n_threads; t++) {                                   \
+      if (args[t].ret != 0) { ret = -1; }                               \
+    }                                                                   \
+    if (ret == 0) {                                                     \
+      /* the folding threads own their shards, so lock them all out */  \
+      for (i = 0; i < s->n_shards; i++) {                               \
+        pthread_mutex_lock(&s->shards[i].lock);                         \
+      }                                                                 \
+      __khs_fold_run_##name(args, threads, n_threads,                   \
+                            __khs_fold_merge_##name);                   \
+      for (i = 0; i < s->n_shards; i++) {                               \
+        pthread_mutex_unlock(&s->shards[i].lock);                       \
+      }                                                                 \
+      for (t = 0; t < n_threads; t++) {                                 \
+        if (args[t].ret != 0) { ret = -1; }                             \
+      }                                                                 \
+    }                                                                   \
+    for (i = 0; i < (khint_t)n_threads * n_threads; i++) {              \
+      free(lists[i].ents);                                              \
+    }                                                                   \
+    free(args);                                                         \
+    free(lists);                                                        \
+    free(threads);                                                      \
+    return ret;                                                         \
+  }
+
+/** Instantiate a sharded map on top of an existing khash instantiation
+ *
+ * @param name          Name of the khash table (as passed to KHASH_INIT)
+ * @param khkey_t       Type of keys
+ * @param khval_t       Type of values
+ * @param kh_is_map     1 if the table is a map, 0 if it is a set
+ * @param __hash_func   Hash function used by the table
+ * @param shard_bits    log2 of the number of shards (0-31)
+ */
+#define KHASH_SHARD_INIT(name, khkey_t, khval_t, kh_is_map, __hash_func, \
+                         shard_bits)                                    \
+  __KHASH_SHARD_TYPES(name, khkey_t, khval_t)                           \
+  __KHASH_SHARD_IMPL(name, UNUSED static kh_inline, khkey_t, khval_t,   \
+                     kh_is_map, __hash_func, shard_bits)
+
+/** Convenience macros */
+
+/** Type of the sharded map
+ *
+ * @param name          Name of the map [symbol]
+ */
+#define khs_t(name) khs_##name##_t
+
+/** Create a new sharded map
+ *
+ * @param name          Name of the map [symbol]
+ * @return pointer to the created map if successful, NULL otherwise
+ */
+#define khs_init(name) khs_init_##name()
+
+/** Destroy the given sharded map
+ *
+ * @param name          Name of the map [symbol]
+ * @param s             Pointer to the map to destroy [khs_t(name)*]
+ */
+#define khs_destroy(name, s) khs_destroy_##name(s)
+
+/** Lock the shard that holds the given key and return its table
+ *
+ * @param name          Name of the map [symbol]
+ * @param s             Pointer to the map [khs_t(name)*]
+ * @param key           Key to lock the shard for [khkey_t]
+ * @return pointer to the (locked) table for the shard [khash_t(name)*]
+ *
+ * Any of the usual kh_* functions may be used on the returned table until
+ * khs_unlock is called with the same key. Iterators are only valid while the
+ * shard is locked.
+ */
+#define khs_lock(name, s, key) khs_lock_##name(s, key)
+
+/** Unlock the shard that holds the given key
+ *
+ * @param name          Name of the map [symbol]
+ * @param s             Pointer to the map [khs_t(name)*]
+ * @param key           Key that was passed to khs_lock [khkey_t]
+ */
+#define khs_unlock(name, s, key) khs_unlock_##name(s, key)
+
+/** Insert a key into the map, merging values if it is already present
+ *
+ * @param name          Name of the map [symbol]
+ * @param s             Pointer to the map [khs_t(name)*]
+ * @param key           Key to insert [khkey_t]
+ * @param val           Value to insert (ignored for sets) [khval_t]
+ * @param merge_f       Function to merge val into an existing value, if NULL
+ *                      existing values are overwritten
+ * @return -1 if an error occurred, 0 if the key was already present, >0 if
+ * it was added
+ */
+#define khs_upsert(name, s, key, val, merge_f)  \
+  khs_upsert_##name(s, key, val, merge_f)
+
+/** Fold a set of khash tables into the sharded map in parallel
+ *
+ * @param name          Name of the map [symbol]
+ * @param s             Pointer to the map [khs_t(name)*]
+ * @param srcs          Array of tables to fold in [khash_t(name)**]
+ * @param n_srcs        Number of tables in srcs
+ * @param n_threads     Number of threads to use (including the caller)
+ * @param merge_f       Function to merge values for keys that are already
+ *                      present, if NULL existing values are overwritten
+ * @return 0 if successful, -1 otherwise
+ *
+ * The source tables are not modified, and must not be modified by other
+ * threads while the fold is in progress. The map is locked while the keys are
+ * merged. If an allocation fails while the keys are being split between the
+ * threads, -1 is returned and the map is left unchanged.
+ */
+#define khs_fold(name, s, srcs, n_srcs, n_threads, merge_f)     \
+  khs_fold_##name(s, srcs, n_srcs, n_threads, merge_f)
+
+/** Get the total number of elements in the map
+ *
+ * @param name          Name of the map [symbol]
+ * @param s             Pointer to the map [khs_t(name)*]
+ * @return number of elements in all shards
+ */
+#define khs_size(name, s) khs_size_##name(s)
+
+/** Iterate over the entries in all shards of the map (without locking)
+ *
+ * @param s             Pointer to the map [khs_t(name)*]
+ * @param kvar          Variable to which key will be assigned
+ * @param vvar          Variable to which value will be assigned
+ * @param code          Block of code to execute
+ */
+#define khs_foreach(s, kvar, vvar, code)                        \
+  {                                                             \
+    khint_t __s;                                                \
+    for (__s = 0; __s < (s)->n_shards; __s++) {                 \
+      kh_foreach((s)->shards[__s].h, kvar, vvar, code);         \
+    }                                                           \
+  }
+
+#endif /* HAVE_PTHREAD */
+
+#endif /* __KHASH_SHARD_H */
@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2026 The Regents of the University of California.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "config.h"
+#ifdef HAVE_PTHREAD
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "klist.h"
+
+/* Process-wide state of the KMEMPOOL_INIT_MT pools: a single key tells them
+   when a thread exits, and the registry lists the pools that thread may hold
+   caches of */
+
+__thread char __kmp_mt_self;
+
+static pthread_key_t exit_key;
+static int exit_key_ok = 0;
+static pthread_once_t exit_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t pools_lock = PTHREAD_MUTEX_INITIALIZER;
+static kmp_mt_hdr_t *pools = NULL;
+
+static void thread_exit(void *self)
+{
+  kmp_mt_hdr_t *hdr;
+  pthread_mutex_lock(&pools_lock);
+  for (hdr = pools; hdr != NULL; hdr = hdr->next) {
+    hdr->release(hdr, self);
+  }
+  pthread_mutex_unlock(&pools_lock);
+}
+
+static void create_key(void)
+{
+  exit_key_ok = pthread_key_create(&exit_key, thread_exit) == 0;
+}
+
+int kmp_mt_register(kmp_mt_hdr_t *hdr)
+{
+  pthread_once(&exit_once, create_key);
+  if (!exit_key_ok) {
+    return -1;
+  }
+  pthread_mutex_lock(&pools_lock);
+  hdr->prev = NULL;
+  if ((hdr->next = pools) != NULL) {
+    pools->prev = hdr;
+  }
+  pools = hdr;
+  pthread_mutex_unlock(&pools_lock);
+  return 0;
+}
+
+void kmp_mt_unregister(kmp_mt_hdr_t *hdr)
+{
+  pthread_mutex_lock(&pools_lock);
+  if (hdr->prev != NULL) {
+    hdr->prev->next = hdr->next;
+  } else {
+    pools = hdr->next;
+  }
+  if (hdr->next != NULL) {
+    hdr->next->prev = hdr->prev;
+  }
+  pthread_mutex_unlock(&pools_lock);
+}
+
+int kmp_mt_thread_init(void)
+{
+  /* the value only needs to be non-NULL for thread_exit to be called */
+  if (pthread_getspecific(exit_key) != NULL) {
+    return 0;
+  }
+  return pthread_setspecific(exit_key, &__kmp_mt_self) == 0 ? 0 : -1;
+}
+
+#endif /* HAVE_PTHREAD */
@@ -26,6 +26,8 @@
 #ifndef _AC_KLIST_H
 #define _AC_KLIST_H
 
+#include "config.h"
+#include <stddef.h>
 #include <stdlib.h>
 
 #define KMEMPOOL_INIT(name, kmptype_t, kmpfree_f)			\
@@ -77,8 +79,13 @@
   } kl_##name##_t;							\
   static inline kl_##name##_t *kl_init_##name(void) {			\
     kl_##name##_t *kl = calloc(1, sizeof(kl_##name##_t));		\
-      kl->mp = kmp_init(name);						\
-      kl->head = kl->tail = kmp_alloc(name, kl->mp);			\
+      if (kl == 0) return 0;						\
+      if ((kl->mp = kmp_init(name)) == 0 ||				\
+          (kl->head = kl->tail = kmp_alloc(name, kl->mp)) == 0) {	\
+        if (kl->mp) kmp_destroy(name, kl->mp);				\
+        free(kl);							\
+        return 0;							\
+      }									\
       kl->head->next = 0;						\
       return kl;							\
   }									\
@@ -118,4 +125,350 @@
 #define kl_pushp(name, kl) kl_pushp_##name(kl)
 #define kl_shift(name, kl, d) kl_shift_##name(kl, d)
 
+/* Intrusive lists: the items embed a kl_link_t (named by the field argument
+   of KLIST_INTR_INIT), so pushing and shifting never allocate or copy, and
+   whole lists can be spliced together in O(1). An item may only be in one
+   list (per link) at a time. */
+typedef struct __kl_link {
+  struct __kl_link *next;
+} kl_link_t;
+
+#define KLIST_INTR_INIT(name, kltype_t, field)				\
+  typedef struct {							\
+    kl_link_t *head, *tail;						\
+    size_t size;							\
+  } kli_##name##_t;							\
+  static inline kltype_t *__kli_item_##name(kl_link_t *l) {		\
+    return l? (kltype_t *)((char *)l - offsetof(kltype_t, field)) : 0;	\
+  }									\
+  static inline void kli_init_##name(kli_##name##_t *kl) {		\
+    kl->head = kl->tail = 0; kl->size = 0;				\
+  }									\
+  static inline kltype_t *kli_next_##name(kltype_t *p) {		\
+    return __kli_item_##name(p->field.next);				\
+  }									\
+  static inline void kli_push_##name(kli_##name##_t *kl, kltype_t *p) {	\
+    p->field.next = 0;							\
+    if (kl->tail) kl->tail->next = &p->field;				\
+    else kl->head = &p->field;						\
+    kl->tail = &p->field; ++kl->size;					\
+  }									\
+  static inline void kli_unshift_##name(kli_##name##_t *kl, kltype_t *p) { \
+    p->field.next = kl->head; kl->head = &p->field;			\
+    if (kl->tail == 0) kl->tail = &p->field;				\
+    ++kl->size;								\
+  }									\
+  static inline kltype_t *kli_shift_##name(kli_##name##_t *kl) {	\
+    kl_link_t *l = kl->head;						\
+    if (l == 0) return 0;						\
+    if ((kl->head = l->next) == 0) kl->tail = 0;			\
+    --kl->size;								\
+    return __kli_item_##name(l);					\
+  }									\
+  static inline void kli_push_n_##name(kli_##name##_t *kl, kltype_t **ps, \
+                                       size_t n) {			\
+    kl_link_t *first, *l;						\
+    size_t k;								\
+    if (n == 0) return;							\
+    /* chain the items together, then attach the chain once */		\
+    first = l = &ps[0]->field;						\
+    for (k = 1; k < n; ++k) l = l->next = &ps[k]->field;		\
+    l->next = 0;							\
+    if (kl->tail) kl->tail->next = first;				\
+    else kl->head = first;						\
+    kl->tail = l; kl->size += n;					\
+  }									\
+  static inline size_t kli_shift_n_##name(kli_##name##_t *kl, kltype_t **ps, \
+                                          size_t n) {			\
+    kl_link_t *l = kl->head;						\
+    size_t k;								\
+    for (k = 0; k < n && l; ++k, l = l->next) ps[k] = __kli_item_##name(l); \
+    if ((kl->head = l) == 0) kl->tail = 0;				\
+    kl->size -= k;							\
+    return k;								\
+  }									\
+  static inline void kli_splice_##name(kli_##name##_t *kl, kltype_t *pos, \
+                                       kli_##name##_t *src) {		\
+    kl_link_t *after;							\
+    if (src->head == 0) return;						\
+    if (pos) {								\
+      after = pos->field.next; pos->field.next = src->head;		\
+    } else {								\
+      after = kl->head; kl->head = src->head;				\
+    }									\
+    src->tail->next = after;						\
+    if (after == 0) kl->tail = src->tail;				\
+    kl->size += src->size;						\
+    kli_init_##name(src);						\
+  }									\
+  static inline void kli_concat_##name(kli_##name##_t *kl,		\
+                                       kli_##name##_t *src) {		\
+    kli_splice_##name(kl, __kli_item_##name(kl->tail), src);		\
+  }									\
+  static inline size_t kli_split_##name(kli_##name##_t *kl, size_t n,	\
+                                        kli_##name##_t *dst) {		\
+    kl_link_t *first = kl->head, *last;					\
+    size_t k;								\
+    if (n >= kl->size) {						\
+      k = kl->size; kli_concat_##name(dst, kl);				\
+      return k;								\
+    }									\
+    if (n == 0) return 0;						\
+    for (last = first, k = 1; k < n; ++k) last = last->next;		\
+    kl->head = last->next; kl->size -= n;				\
+    last->next = 0;							\
+    if (dst->tail) dst->tail->next = first;				\
+    else dst->head = first;						\
+    dst->tail = last; dst->size += n;					\
+    return n;								\
+  }
+
+#define klist_intr_t(name) kli_##name##_t
+#define kli_size(kl) ((kl)->size)
+#define kli_begin(name, kl) __kli_item_##name((kl)->head)
+#define kli_next(name, p) kli_next_##name(p)
+
+#define kli_init(name, kl) kli_init_##name(kl)
+#define kli_push(name, kl, p) kli_push_##name(kl, p)
+#define kli_unshift(name, kl, p) kli_unshift_##name(kl, p)
+#define kli_shift(name, kl) kli_shift_##name(kl)
+/* Push the n items in ps, in order */
+#define kli_push_n(name, kl, ps, n) kli_push_n_##name(kl, ps, n)
+/* Shift up to n items into ps; returns how many were shifted */
+#define kli_shift_n(name, kl, ps, n) kli_shift_n_##name(kl, ps, n)
+/* Insert all items of src after item pos of kl (at its head if pos is 0),
+   leaving src empty; O(1) */
+#define kli_splice(name, kl, pos, src) kli_splice_##name(kl, pos, src)
+/* Append all items of src to kl, leaving src empty; O(1) */
+#define kli_concat(name, kl, src) kli_concat_##name(kl, src)
+/* Move the first n items of kl to the end of dst; returns how many were
+   moved. Only walks the moved items' links (and not at all if n covers the
+   whole list). */
+#define kli_split(name, kl, n, dst) kli_split_##name(kl, n, dst)
+
+#ifdef HAVE_PTHREAD
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+/* KMEMPOOL_INIT_MT is an alternative to KMEMPOOL_INIT (with the same kmp_*
+   interface) for pools that are shared by several threads. Objects are carved
+   from slabs, freed objects are kept on intrusive free lists, and each thread
+   allocates from and frees to its own cache, which it refills from (and
+   flushes to) a lock-free list shared by all threads. An object may be freed
+   by a different thread than the one that allocated it, and objects cached by
+   a thread that exits are handed back to the pool.
+
+   kmp_destroy must not run concurrently with other operations on the pool,
+   and releases the memory of every object, including those still in use. */
+
+/* Objects are carved from slabs of (about) this many bytes */
+#ifndef KMP_SLAB_SIZE
+#define KMP_SLAB_SIZE 65536
+#endif
+
+/* Number of per-thread caches in each pool. A thread claims a cache the first
+   time it uses the pool and releases it when it exits; while more threads than
+   this are using the pool, the others share one extra cache protected by a
+   spinlock */
+#ifndef KMP_CACHES
+#define KMP_CACHES 16
+#endif
+
+/* A per-thread cache holding more than this many freed objects hands half of
+   them back to the pool */
+#ifndef KMP_CACHE_MAX
+#define KMP_CACHE_MAX 256
+#endif
+
+#define KMP_CACHELINE 64
+
+/* Common header of KMEMPOOL_INIT_MT pools, which are registered (in klist.c)
+   so that the caches of a thread can be released when it exits */
+typedef struct kmp_mt_hdr {
+  struct kmp_mt_hdr *prev, *next;
+  /* release the caches owned by the thread identified by self */
+  void (*release)(struct kmp_mt_hdr *hdr, void *self);
+} kmp_mt_hdr_t;
+
+/* Its address identifies the calling thread */
+extern __thread char __kmp_mt_self;
+
+/* Add a pool to (or remove it from) the registry, returns 0 or -1 */
+int kmp_mt_register(kmp_mt_hdr_t *hdr);
+void kmp_mt_unregister(kmp_mt_hdr_t *hdr);
+
+/* Make sure the pools are told when the calling thread exits, returns 0 or
+   -1 */
+int kmp_mt_thread_init(void);
+
+#define KMEMPOOL_INIT_MT(name, kmptype_t, kmpfree_f)			\
+  /* the free list link follows the object, so that freed objects keep	\
+     their contents until they are reused (or passed to kmpfree_f) */	\
+  typedef struct __kmp_##name##_cell {					\
+    kmptype_t data;							\
+    struct __kmp_##name##_cell *next;					\
+  } kmp_##name##_cell_t;						\
+  typedef struct __kmp_##name##_slab {					\
+    struct __kmp_##name##_slab *next;					\
+    kmp_##name##_cell_t cells[];					\
+  } kmp_##name##_slab_t;						\
+  typedef struct {							\
+    void *owner;							\
+    int lock;								\
+    size_t n;								\
+    kmp_##name##_cell_t *free, *cur, *end;				\
+  } __attribute__((aligned(KMP_CACHELINE))) kmp_##name##_cache_t;	\
+  typedef struct {							\
+    kmp_mt_hdr_t hdr;							\
+    kmp_##name##_cache_t cache[KMP_CACHES + 1];				\
+    kmp_##name##_cell_t *free;						\
+    kmp_##name##_slab_t *slabs;						\
+  } kmp_##name##_t;							\
+  /* push a chain of cells onto the pool's free list */			\
+  static inline void __kmp_push_##name(kmp_##name##_t *mp,		\
+                                       kmp_##name##_cell_t *head,	\
+                                       kmp_##name##_cell_t *tail) {	\
+    tail->next = __atomic_load_n(&mp->free, __ATOMIC_RELAXED);		\
+    while (!__atomic_compare_exchange_n(&mp->free, &tail->next, head, 1, \
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) ; \
+  }									\
+  /* called (under the registry lock) when a thread exits */		\
+  static inline void __kmp_release_##name(kmp_mt_hdr_t *hdr, void *self) { \
+    kmp_##name##_t *mp = (kmp_##name##_t *)hdr;				\
+    kmp_##name##_cache_t *c;						\
+    kmp_##name##_cell_t *tail;						\
+    int k;								\
+    for (k = 0; k < KMP_CACHES; ++k) {					\
+      c = &mp->cache[k];						\
+      if (__atomic_load_n(&c->owner, __ATOMIC_RELAXED) != self) continue; \
+      if ((tail = c->free) != NULL) {					\
+        while (tail->next) tail = tail->next;				\
+        __kmp_push_##name(mp, c->free, tail);				\
+      }									\
+      /* the rest of the cache's slab is left for its next owner */	\
+      c->free = NULL; c->n = 0;						\
+      __atomic_store_n(&c->owner, NULL, __ATOMIC_RELEASE);		\
+    }									\
+  }									\
+  static inline kmp_##name##_t *kmp_init_##name(void) {			\
+    kmp_##name##_t *mp;							\
+    void *mem;								\
+    if (posix_memalign(&mem, KMP_CACHELINE, sizeof(kmp_##name##_t)) != 0) \
+      return NULL;							\
+    mp = memset(mem, 0, sizeof(kmp_##name##_t));			\
+    mp->hdr.release = __kmp_release_##name;				\
+    if (kmp_mt_register(&mp->hdr) != 0) {				\
+      free(mp);								\
+      return NULL;							\
+    }									\
+    return mp;								\
+  }									\
+  static inline void kmp_destroy_##name(kmp_##name##_t *mp) {		\
+    kmp_##name##_cell_t *p;						\
+    kmp_##name##_slab_t *s;						\
+    size_t k;								\
+    kmp_mt_unregister(&mp->hdr);					\
+    for (k = 0; k <= KMP_CACHES; ++k)					\
+      for (p = mp->cache[k].free; p; p = p->next) kmpfree_f(&p->data);	\
+    for (p = mp->free; p; p = p->next) kmpfree_f(&p->data);		\
+    while ((s = mp->slabs) != NULL) {					\
+      mp->slabs = s->next; free(s);					\
+    }									\
+    free(mp);								\
+  }									\
+  /* find (or claim) the calling thread's cache, which is the shared one \
+     (cache[KMP_CACHES]) if all others are taken */			\
+  static inline kmp_##name##_cache_t *__kmp_cache_##name(kmp_##name##_t *mp) { \
+    void *self = &__kmp_mt_self, *owner;				\
+    size_t k, h0 = ((uintptr_t)self / KMP_CACHELINE) % KMP_CACHES, h;	\
+    for (k = 0, h = h0; k < KMP_CACHES; ++k, h = (h + 1) % KMP_CACHES)	\
+      if (__atomic_load_n(&mp->cache[h].owner, __ATOMIC_RELAXED) == self) \
+        return &mp->cache[h];						\
+    for (k = 0, h = h0; k < KMP_CACHES; ++k, h = (h + 1) % KMP_CACHES) { \
+      owner = NULL;							\
+      if (__atomic_load_n(&mp->cache[h].owner, __ATOMIC_RELAXED) == NULL && \
+          __atomic_compare_exchange_n(&mp->cache[h].owner, &owner, self, 0, \
+                                      __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) { \
+        if (kmp_mt_thread_init() == 0) return &mp->cache[h];		\
+        /* could not arrange to release it at exit, so don't keep it */	\
+        __atomic_store_n(&mp->cache[h].owner, NULL, __ATOMIC_RELEASE);	\
+        break;								\
+      }									\
+    }									\
+    return &mp->cache[KMP_CACHES];					\
+  }									\
+  static inline void __kmp_lock_##name(kmp_##name##_cache_t *c) {	\
+    while (__atomic_exchange_n(&c->lock, 1, __ATOMIC_ACQUIRE))		\
+      while (__atomic_load_n(&c->lock, __ATOMIC_RELAXED)) ;		\
+  }									\
+  static inline void __kmp_unlock_##name(kmp_##name##_cache_t *c) {	\
+    __atomic_store_n(&c->lock, 0, __ATOMIC_RELEASE);			\
+  }									\
+  static inline kmptype_t *__kmp_get_##name(kmp_##name##_t *mp,		\
+                                            kmp_##name##_cache_t *c) {	\
+    kmp_##name##_cell_t *p;						\
+    kmp_##name##_slab_t *s;						\
+    size_t n;								\
+    if ((p = c->free) == NULL) {					\
+      /* take everything other threads have handed back... */		\
+      p = __atomic_exchange_n(&mp->free, NULL, __ATOMIC_ACQUIRE);	\
+      if (p == NULL) {							\
+        /* ...or carve a new (zeroed) object from the cache's slab */	\
+        if (c->cur == c->end) {						\
+          n = (KMP_SLAB_SIZE - sizeof(kmp_##name##_slab_t))		\
+            / sizeof(kmp_##name##_cell_t);				\
+          if (n == 0) n = 1;						\
+          s = calloc(1, sizeof(kmp_##name##_slab_t) +			\
+                     n * sizeof(kmp_##name##_cell_t));			\
+          if (s == NULL) return NULL;					\
+          s->next = __atomic_load_n(&mp->slabs, __ATOMIC_RELAXED);	\
+          while (!__atomic_compare_exchange_n(&mp->slabs, &s->next, s, 1, \
+                                              __ATOMIC_RELAXED,		\
+                                              __ATOMIC_RELAXED)) ;	\
+          c->cur = s->cells; c->end = s->cells + n;			\
+        }								\
+        return &(c->cur++)->data;					\
+      }									\
+      c->n = 0;								\
+    }									\
+    c->free = p->next;							\
+    if (c->n) --c->n;							\
+    return &p->data;							\
+  }									\
+  static inline void __kmp_put_##name(kmp_##name##_t *mp,		\
+                                      kmp_##name##_cache_t *c,		\
+                                      kmp_##name##_cell_t *p) {		\
+    kmp_##name##_cell_t *tail = p;					\
+    size_t k;								\
+    p->next = c->free; c->free = p;					\
+    if (++c->n <= KMP_CACHE_MAX) return;				\
+    /* push the most recently freed half onto the pool's free list */	\
+    for (k = 1; k < KMP_CACHE_MAX / 2; ++k) tail = tail->next;		\
+    c->free = tail->next; c->n -= KMP_CACHE_MAX / 2;			\
+    __kmp_push_##name(mp, p, tail);					\
+  }									\
+  static inline kmptype_t *kmp_alloc_##name(kmp_##name##_t *mp) {	\
+    kmp_##name##_cache_t *c = __kmp_cache_##name(mp);			\
+    kmptype_t *p;							\
+    if (c != &mp->cache[KMP_CACHES]) return __kmp_get_##name(mp, c);	\
+    __kmp_lock_##name(c);						\
+    p = __kmp_get_##name(mp, c);					\
+    __kmp_unlock_##name(c);						\
+    return p;								\
+  }									\
+  static inline void kmp_free_##name(kmp_##name##_t *mp, kmptype_t *p) { \
+    kmp_##name##_cache_t *c = __kmp_cache_##name(mp);			\
+    if (c != &mp->cache[KMP_CACHES]) {					\
+      __kmp_put_##name(mp, c, (kmp_##name##_cell_t *)p);		\
+      return;								\
+    }									\
+    __kmp_lock_##name(c);						\
+    __kmp_put_##name(mp, c, (kmp_##name##_cell_t *)p);			\
+    __kmp_unlock_##name(c);						\
+  }
+
+#endif /* HAVE_PTHREAD */
+
 #endif